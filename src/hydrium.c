@@ -32,8 +32,29 @@ static void print_usage(const char *argv0) {
     fprintf(stderr, "                       Tile dimensions will be 256 * 2^N\n");
     fprintf(stderr, "                       Larger tiles use more memory but decode faster.\n");
     fprintf(stderr, "                       (default: N=0)\n");
+    fprintf(stderr, "    --distance=D   Use butteraugli distance D, valid values are 0.1 through 25\n");
+    fprintf(stderr, "                       Lower distances give higher quality and larger files.\n");
+    fprintf(stderr, "                       (default: D=1.0)\n");
+    fprintf(stderr, "    --target-size=N\n");
+    fprintf(stderr, "                   Aim for an output of at most N bytes, in place of a distance\n");
+    fprintf(stderr, "    --target-bpp=B Aim for at most B bits per pixel, in place of a distance\n");
     fprintf(stderr, "    --one-frame    Use one frame. Uses more memory but decodes faster.\n");
     fprintf(stderr, "                       (default: off)\n");
+    fprintf(stderr, "    --fixed-histograms\n");
+    fprintf(stderr, "                   Use built-in HF histograms. Files are slightly larger, but\n");
+    fprintf(stderr, "                       one-frame memory no longer grows with the image size.\n");
+    fprintf(stderr, "                       (default: off)\n");
+    fprintf(stderr, "    --merge-clusters\n");
+    fprintf(stderr, "                   Merge HF histograms that code smaller together, per frame.\n");
+    fprintf(stderr, "                       Helps most with small tiles.\n");
+    fprintf(stderr, "                       (default: off)\n");
+    fprintf(stderr, "    --prefix-codes Code HF coefficients with prefix codes instead of ANS.\n");
+    fprintf(stderr, "                       Encodes faster, but files are larger.\n");
+    fprintf(stderr, "                       (default: off)\n");
+    fprintf(stderr, "    --lz77-window=N\n");
+    fprintf(stderr, "                   Search N symbols back for LZ77 repeats, at most 1048576.\n");
+    fprintf(stderr, "                       Larger windows find repeats farther apart, but encode slower.\n");
+    fprintf(stderr, "                       (default: picked per stream)\n");
     fprintf(stderr, "    --pfm          Assume input is PFM (Portable FloatMap)\n");
     fprintf(stderr, "    --png          Assume input is PNG (Portable Network Graphics)\n");
     fprintf(stderr, "                       (default: assume PNG unless input filename ends with .pfm)\n");
@@ -85,10 +106,17 @@ int main(int argc, const char *argv[]) {
     }
 
     int one_frame = 0;
+    int fixed_histograms = 0;
+    int merge_clusters = 0;
+    int prefix_codes = 0;
     int pfm = -1;
     int linear = 0;
     int endianness = 0;
     long tilesize = 0;
+    double distance = 1.0;
+    long long target_size = 0;
+    long lz77_window = 0;
+    double target_bpp = 0.0;
     int argp = 0;
     const char *in_fname = NULL;
     const char *out_fname = NULL;
@@ -112,6 +140,12 @@ int main(int argc, const char *argv[]) {
             found_mm = 1;
         } else if (!strcmp(argv[argp], "--one-frame")) {
             one_frame = 1;
+        } else if (!strcmp(argv[argp], "--fixed-histograms")) {
+            fixed_histograms = 1;
+        } else if (!strcmp(argv[argp], "--merge-clusters")) {
+            merge_clusters = 1;
+        } else if (!strcmp(argv[argp], "--prefix-codes")) {
+            prefix_codes = 1;
         } else if (!strncmp(argv[argp], "--tile-size=", 12)) {
             errno = 0;
             tilesize = strtol(argv[argp] + 12, NULL, 10);
@@ -125,6 +159,47 @@ int main(int argc, const char *argv[]) {
                 fprintf(stderr, "Please run: %s --help\n", argv[0]);
                 return 2;
             }
+        } else if (!strncmp(argv[argp], "--distance=", 11)) {
+            char *end;
+            errno = 0;
+            distance = strtod(argv[argp] + 11, &end);
+            if (errno || end == argv[argp] + 11 || *end) {
+                fprintf(stderr, "Invalid number: %s\n", argv[argp] + 11);
+                fprintf(stderr, "Please run: %s --help\n", argv[0]);
+                return 2;
+            }
+            if (!(distance >= 0.1 && distance <= 25.0)) {
+                fprintf(stderr, "Invalid distance, must be 0.1-25: %s\n", argv[argp] + 11);
+                fprintf(stderr, "Please run: %s --help\n", argv[0]);
+                return 2;
+            }
+        } else if (!strncmp(argv[argp], "--target-size=", 14)) {
+            char *end;
+            errno = 0;
+            target_size = strtoll(argv[argp] + 14, &end, 10);
+            if (errno || end == argv[argp] + 14 || *end || target_size <= 0) {
+                fprintf(stderr, "Invalid size: %s\n", argv[argp] + 14);
+                fprintf(stderr, "Please run: %s --help\n", argv[0]);
+                return 2;
+            }
+        } else if (!strncmp(argv[argp], "--target-bpp=", 13)) {
+            char *end;
+            errno = 0;
+            target_bpp = strtod(argv[argp] + 13, &end);
+            if (errno || end == argv[argp] + 13 || *end || !(target_bpp > 0.0 && target_bpp <= 96.0)) {
+                fprintf(stderr, "Invalid bits per pixel: %s\n", argv[argp] + 13);
+                fprintf(stderr, "Please run: %s --help\n", argv[0]);
+                return 2;
+            }
+        } else if (!strncmp(argv[argp], "--lz77-window=", 14)) {
+            char *end;
+            errno = 0;
+            lz77_window = strtol(argv[argp] + 14, &end, 10);
+            if (errno || end == argv[argp] + 14 || *end || lz77_window <= 0 || lz77_window > 1 << 20) {
+                fprintf(stderr, "Invalid LZ77 window, must be 1-1048576: %s\n", argv[argp] + 14);
+                fprintf(stderr, "Please run: %s --help\n", argv[0]);
+                return 2;
+            }
         } else if (!strcmp(argv[argp], "--pfm")) {
             pfm = 1;
         } else if (!strcmp(argv[argp], "--png")) {
@@ -257,6 +332,12 @@ int main(int argc, const char *argv[]) {
     metadata.linear_light = linear;
     metadata.tile_size_shift_x = one_frame ? -1 : tilesize;
     metadata.tile_size_shift_y = one_frame ? -1 : tilesize;
+    metadata.distance = distance;
+    metadata.target_size = target_bpp > 0.0 ? (size_t)(target_bpp * width * height / 8.0 + 0.5) : (size_t)target_size;
+    metadata.fixed_histograms = fixed_histograms;
+    metadata.merge_clusters = merge_clusters;
+    metadata.prefix_codes = prefix_codes;
+    metadata.lz77_window = lz77_window;
     const uint32_t size_shift_x = metadata.tile_size_shift_x < 0 ? 3 : metadata.tile_size_shift_x;
     const uint32_t size_shift_y = metadata.tile_size_shift_y < 0 ? 3 : metadata.tile_size_shift_y;
     const uint32_t tile_size_x = 256 << size_shift_x;
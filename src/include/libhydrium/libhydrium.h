@@ -164,6 +164,57 @@ typedef struct HYDImageMetadata {
      * but it decodes faster with libjxl.
      */
     int tile_size_shift_y;
+
+    /**
+     * The target distance, in the butteraugli sense. Lower values give higher
+     * quality and larger files, and 1.0 is visually lossless for most images.
+     * Valid values are 0.1 through 25.0. A special value of 0 selects the
+     * default, which is 1.0.
+     */
+    float distance;
+
+    /**
+     * A budget for the size of the encoded image, in bytes. If nonzero, distance is
+     * ignored: libhydrium estimates the size of every strip of the image as it encodes it,
+     * and adjusts the quantization of the strips to come so that the whole image lands
+     * under the budget in a single pass. As the estimates are a few percent off, it holds
+     * some of the budget back, so files tend to come out a little smaller, and more so
+     * with fixed_histograms. Budgets too small for the coarsest quantizer are exceeded.
+     */
+    size_t target_size;
+
+    /**
+     * A flag indicating whether to code the HF coefficients with histograms built into
+     * libhydrium, instead of histograms counted from the image. With one Frame for the
+     * entire image, each group is then entropy-coded as soon as its tile is sent, so the
+     * memory used no longer grows with the image size. Files come out slightly larger.
+     * Ignored when tiles are separate Frames, as each Frame would carry the histograms, and
+     * for images of a single group, which have nothing to code ahead.
+     */
+    int fixed_histograms;
+
+    /**
+     * A flag indicating whether to merge the HF context clusters whose histograms code smaller
+     * together, per Frame, instead of always sending the fixed set of clusters. This shrinks
+     * the histograms sent with each Frame, which matters most for small tiles. Ignored when
+     * fixed_histograms applies.
+     */
+    int merge_clusters;
+
+    /**
+     * A flag indicating whether to code the HF coefficients with prefix codes instead of ANS.
+     * Prefix codes are written in one forward pass, without the reverse pass and alias tables
+     * of ANS, so encoding takes less time, at the cost of somewhat larger files.
+     * fixed_histograms is ignored when this is set.
+     */
+    int prefix_codes;
+
+    /**
+     * How many symbols back LZ77 searches for repeats in the entropy-coded streams, at most
+     * 1 << 20. Larger windows find repeats that lie farther apart, such as in large tiled
+     * textures, at the cost of memory and encode time. Zero picks a window per stream.
+     */
+    size_t lz77_window;
 } HYDImageMetadata;
 
 /* opaque structure */
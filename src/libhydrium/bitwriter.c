@@ -35,6 +35,17 @@ static void hyd_bitwriter_flush0(HYDBitWriter *bw) {
     }
 }
 
+/* reallocate the buffer, and move the overflow into it */
+static HYDStatusCode hyd_bitwriter_grow(HYDBitWriter *bw) {
+    bw->overflow_state = bw->realloc_func(bw->allocator, &bw->buffer, &bw->buffer_len);
+    if (bw->overflow_state < HYD_ERROR_START)
+        return bw->overflow_state;
+    memcpy(bw->buffer + bw->buffer_pos, bw->overflow, bw->overflow_pos);
+    bw->buffer_pos += bw->overflow_pos;
+    bw->overflow_pos = 0;
+    return bw->overflow_state;
+}
+
 HYDStatusCode hyd_write(HYDBitWriter *bw, uint64_t value, int bits) {
     if (bits <= 0)
         return bw->overflow_state;
@@ -48,12 +59,8 @@ HYDStatusCode hyd_write(HYDBitWriter *bw, uint64_t value, int bits) {
     hyd_bitwriter_flush0(bw);
     if (bw->overflow_pos) {
         if (bw->realloc_func) {
-            bw->overflow_state = bw->realloc_func(bw->allocator, &bw->buffer, &bw->buffer_len);
-            if (bw->overflow_state < HYD_ERROR_START)
+            if (hyd_bitwriter_grow(bw) < HYD_ERROR_START)
                 return bw->overflow_state;
-            memcpy(bw->buffer + bw->buffer_pos, bw->overflow, bw->overflow_pos);
-            bw->buffer_pos += bw->overflow_pos;
-            bw->overflow_pos = 0;
         } else {
             bw->overflow_state = HYD_NEED_MORE_OUTPUT;
         }
@@ -82,6 +89,25 @@ HYDStatusCode hyd_write_u32(HYDBitWriter *bw, const U32Table *table, uint32_t va
 HYDStatusCode hyd_bitwriter_flush(HYDBitWriter *bw) {
     hyd_write_zero_pad(bw);
     hyd_bitwriter_flush0(bw);
+    /* so that buffer_pos counts every byte written, as section ends are taken from it */
+    if (bw->overflow_pos && bw->realloc_func)
+        hyd_bitwriter_grow(bw);
+    return bw->overflow_state;
+}
+
+HYDStatusCode hyd_write_bytes(HYDBitWriter *bw, const uint8_t *data, size_t len) {
+    hyd_bitwriter_flush0(bw);
+    if (bw->cache_bits || bw->overflow_pos || !bw->realloc_func) {
+        for (size_t i = 0; i < len; i++)
+            hyd_write(bw, data[i], 8);
+        return bw->overflow_state;
+    }
+    while (bw->buffer_len - bw->buffer_pos < len) {
+        if (hyd_bitwriter_grow(bw) < HYD_ERROR_START)
+            return bw->overflow_state;
+    }
+    memcpy(bw->buffer + bw->buffer_pos, data, len);
+    bw->buffer_pos += len;
     return bw->overflow_state;
 }
 
@@ -32,5 +32,7 @@ HYDStatusCode hyd_write_u32(HYDBitWriter *bw, const U32Table *table, uint32_t va
 HYDStatusCode hyd_write_u64(HYDBitWriter *bw, uint64_t value);
 HYDStatusCode hyd_write_bool(HYDBitWriter *bw, int flag);
 HYDStatusCode hyd_bitwriter_flush(HYDBitWriter *bw);
+/* append len bytes, which take a single copy when the writer is byte-aligned and can grow */
+HYDStatusCode hyd_write_bytes(HYDBitWriter *bw, const uint8_t *data, size_t len);
 
 #endif /* HYDRIUM_BITWRITER_H_ */
@@ -0,0 +1,190 @@
+/*
+ * DCT kernel template
+ *
+ * Define DCT_SUFFIX and DCT_TARGET before including this file.
+ * Each vector holds one row of a block. A lane-wise 1-D DCT over the eight
+ * row vectors performs the vertical pass, an in-register transpose follows,
+ * and a second lane-wise DCT performs the horizontal pass. The arithmetic
+ * per coefficient is identical to the scalar kernel in dct.c, and the
+ * quantization is shared with it. The kernel for the larger transforms works
+ * the same way on eight columns at a time, transposing 8x8 tiles in between.
+ */
+
+#define DCT_CAT0(a, b) a ## _ ## b
+#define DCT_CAT(a, b) DCT_CAT0(a, b)
+#define DCT_FN(name) DCT_CAT(name, DCT_SUFFIX)
+
+typedef float DCT_FN(vf) __attribute__((vector_size(32)));
+typedef int32_t DCT_FN(vi) __attribute__((vector_size(32)));
+
+DCT_TARGET static inline void DCT_FN(fdct8)(DCT_FN(vf) out[8], const DCT_FN(vf) in[8], const float scale) {
+    const DCT_FN(vf) tmp0 = in[0] + in[7];
+    const DCT_FN(vf) tmp7 = in[0] - in[7];
+    const DCT_FN(vf) tmp1 = in[1] + in[6];
+    const DCT_FN(vf) tmp6 = in[1] - in[6];
+    const DCT_FN(vf) tmp2 = in[2] + in[5];
+    const DCT_FN(vf) tmp5 = in[2] - in[5];
+    const DCT_FN(vf) tmp3 = in[3] + in[4];
+    const DCT_FN(vf) tmp4 = in[3] - in[4];
+
+    /* even part */
+    const DCT_FN(vf) tmp10 = tmp0 + tmp3;
+    const DCT_FN(vf) tmp13 = tmp0 - tmp3;
+    const DCT_FN(vf) tmp11 = tmp1 + tmp2;
+    const DCT_FN(vf) tmp12 = tmp1 - tmp2;
+    const DCT_FN(vf) z1 = (tmp12 + tmp13) * 0.541196100f;
+    out[0] = (tmp10 + tmp11) * scale;
+    out[4] = (tmp10 - tmp11) * scale;
+    out[2] = (z1 + tmp13 * 0.765366865f) * scale;
+    out[6] = (z1 - tmp12 * 1.847759065f) * scale;
+
+    /* odd part */
+    const DCT_FN(vf) z5 = (tmp4 + tmp5 + tmp6 + tmp7) * 1.175875602f;
+    const DCT_FN(vf) o1 = (tmp4 + tmp7) * -0.899976223f;
+    const DCT_FN(vf) o2 = (tmp5 + tmp6) * -2.562915447f;
+    const DCT_FN(vf) o3 = (tmp4 + tmp6) * -1.961570560f + z5;
+    const DCT_FN(vf) o4 = (tmp5 + tmp7) * -0.390180644f + z5;
+    out[7] = (tmp4 * 0.298631336f + o1 + o3) * scale;
+    out[5] = (tmp5 * 2.053119869f + o2 + o4) * scale;
+    out[3] = (tmp6 * 3.072711026f + o2 + o3) * scale;
+    out[1] = (tmp7 * 1.501321110f + o1 + o4) * scale;
+}
+
+/* 8x8 transpose: interleave 32-bit pairs, then 64-bit pairs, then 128-bit halves */
+DCT_TARGET static inline void DCT_FN(transpose)(DCT_FN(vf) out[8], const DCT_FN(vf) in[8]) {
+    DCT_FN(vf) t[8], u[8];
+    for (int i = 0; i < 8; i += 2) {
+        t[i] = hyd_shuffle8(DCT_FN(vi), in[i], in[i + 1], 0, 8, 1, 9, 4, 12, 5, 13);
+        t[i + 1] = hyd_shuffle8(DCT_FN(vi), in[i], in[i + 1], 2, 10, 3, 11, 6, 14, 7, 15);
+    }
+    for (int i = 0; i < 8; i += 4) {
+        u[i] = hyd_shuffle8(DCT_FN(vi), t[i], t[i + 2], 0, 1, 8, 9, 4, 5, 12, 13);
+        u[i + 1] = hyd_shuffle8(DCT_FN(vi), t[i], t[i + 2], 2, 3, 10, 11, 6, 7, 14, 15);
+        u[i + 2] = hyd_shuffle8(DCT_FN(vi), t[i + 1], t[i + 3], 0, 1, 8, 9, 4, 5, 12, 13);
+        u[i + 3] = hyd_shuffle8(DCT_FN(vi), t[i + 1], t[i + 3], 2, 3, 10, 11, 6, 7, 14, 15);
+    }
+    for (int i = 0; i < 4; i++) {
+        out[i] = hyd_shuffle8(DCT_FN(vi), u[i], u[i + 4], 0, 1, 2, 3, 8, 9, 10, 11);
+        out[i + 4] = hyd_shuffle8(DCT_FN(vi), u[i], u[i + 4], 4, 5, 6, 7, 12, 13, 14, 15);
+    }
+}
+
+DCT_TARGET static uint32_t DCT_FN(dct_kernel)(XYBEntry coeffs[64], const XYBEntry *block, ptrdiff_t stride,
+                                              const float weights[64], float max_weight, float mult,
+                                              const float *pred, float *recon, size_t *last) {
+    DCT_FN(vf) rows[8], cols[8];
+    float out[64];
+    for (int y = 0; y < 8; y++)
+        memcpy(&rows[y], block + y * stride, sizeof(rows[y]));
+    /* vertical pass, lane x of cols[k] holds vertical frequency k of column x */
+    DCT_FN(fdct8)(cols, rows, 1.0f);
+    DCT_FN(transpose)(rows, cols);
+    /* horizontal pass, lane k of cols[h] holds horizontal frequency h */
+    DCT_FN(fdct8)(cols, rows, 0.015625f);
+    /* the same all-zero test as the scalar kernel, where lane 0 of cols[0] is the DC */
+    const DCT_FN(vi) ac_lanes = {0, -1, -1, -1, -1, -1, -1, -1};
+    DCT_FN(vi) any = {0};
+    for (int h = 0; h < 8; h++) {
+        const DCT_FN(vf) mag = (DCT_FN(vf))((DCT_FN(vi))cols[h] & 0x7FFFFFFF);
+        const DCT_FN(vi) big = mag * max_weight * mult >= 2.0f;
+        any |= h ? big : big & ac_lanes;
+    }
+    int32_t nonzero = 0;
+    for (int i = 0; i < 8; i++)
+        nonzero |= any[i];
+    if (!nonzero && !pred)
+        return zero_block(coeffs, cols[0][0], recon, last);
+    for (int h = 0; h < 8; h++)
+        memcpy(out + 8 * h, &cols[h], sizeof(cols[h]));
+    return quantize_block(coeffs, out, weights, mult, pred, recon, last);
+}
+
+/* lane-wise versions of fdct16 and fdct32 in dct.c */
+DCT_TARGET static inline void DCT_FN(fdct16)(DCT_FN(vf) out[16], const DCT_FN(vf) in[16]) {
+    DCT_FN(vf) even[8], odd[8], even_out[8], odd_out[8];
+    for (int i = 0; i < 8; i++) {
+        even[i] = in[i] + in[15 - i];
+        odd[i] = (in[i] - in[15 - i]) * odd_scale16[i];
+    }
+    DCT_FN(fdct8)(even_out, even, 1.0f);
+    DCT_FN(fdct8)(odd_out, odd, 1.0f);
+    for (int k = 0; k < 8; k++)
+        out[2 * k] = even_out[k];
+    out[1] = odd_out[0] * 1.414213562f + odd_out[1];
+    for (int k = 1; k < 7; k++)
+        out[2 * k + 1] = odd_out[k] + odd_out[k + 1];
+    out[15] = odd_out[7];
+}
+
+DCT_TARGET static inline void DCT_FN(fdct32)(DCT_FN(vf) out[32], const DCT_FN(vf) in[32]) {
+    DCT_FN(vf) even[16], odd[16], even_out[16], odd_out[16];
+    for (int i = 0; i < 16; i++) {
+        even[i] = in[i] + in[31 - i];
+        odd[i] = (in[i] - in[31 - i]) * odd_scale32[i];
+    }
+    DCT_FN(fdct16)(even_out, even);
+    DCT_FN(fdct16)(odd_out, odd);
+    for (int k = 0; k < 16; k++)
+        out[2 * k] = even_out[k];
+    out[1] = odd_out[0] * 1.414213562f + odd_out[1];
+    for (int k = 1; k < 15; k++)
+        out[2 * k + 1] = odd_out[k] + odd_out[k + 1];
+    out[31] = odd_out[15];
+}
+
+DCT_TARGET static inline void DCT_FN(fdct_n)(DCT_FN(vf) *out, const DCT_FN(vf) *in, const size_t n) {
+    if (n == 8)
+        DCT_FN(fdct8)(out, in, 1.0f);
+    else if (n == 16)
+        DCT_FN(fdct16)(out, in);
+    else
+        DCT_FN(fdct32)(out, in);
+}
+
+DCT_TARGET static uint32_t DCT_FN(dct_large_kernel)(XYBEntry *coeffs, const XYBEntry *block, ptrdiff_t stride,
+                                                    size_t rows, size_t cols, const float *weights,
+                                                    float max_weight, float mult, const float *pred,
+                                                    float *recon, size_t *last) {
+    DCT_FN(vf) vec[32], freq[32], tile[8];
+    float scratch[32 * 32], out[32 * 32];
+    const float scale = 1.0f / (rows * cols);
+    /* the all-zero test of the DCT8 kernel, where lanes below side_v of the first side_h rows hold LF values */
+    const int32_t side_v = rows >> 3;
+    const size_t side_h = cols >> 3;
+    const DCT_FN(vi) hf_lanes = (DCT_FN(vi)){0, 1, 2, 3, 4, 5, 6, 7} >= side_v;
+    DCT_FN(vi) any = {0};
+    /* vertical pass, eight columns at a time, lane x of freq[v] holds vertical frequency v of column x */
+    for (size_t x0 = 0; x0 < cols; x0 += 8) {
+        for (size_t y = 0; y < rows; y++)
+            memcpy(&vec[y], block + y * stride + x0, sizeof(vec[y]));
+        DCT_FN(fdct_n)(freq, vec, rows);
+        for (size_t v = 0; v < rows; v++)
+            memcpy(scratch + v * cols + x0, &freq[v], sizeof(freq[v]));
+    }
+    /* horizontal pass, eight vertical frequencies at a time, lane v of freq[h] holds horizontal frequency h */
+    for (size_t v0 = 0; v0 < rows; v0 += 8) {
+        for (size_t x0 = 0; x0 < cols; x0 += 8) {
+            for (int i = 0; i < 8; i++)
+                memcpy(&tile[i], scratch + (v0 + i) * cols + x0, sizeof(tile[i]));
+            DCT_FN(transpose)(vec + x0, tile);
+        }
+        DCT_FN(fdct_n)(freq, vec, cols);
+        for (size_t h = 0; h < cols; h++) {
+            const DCT_FN(vf) scaled = freq[h] * scale;
+            const DCT_FN(vf) mag = (DCT_FN(vf))((DCT_FN(vi))scaled & 0x7FFFFFFF);
+            const DCT_FN(vi) big = mag * max_weight * mult >= 2.0f;
+            any |= v0 || h >= side_h ? big : big & hf_lanes;
+            memcpy(out + h * rows + v0, &scaled, sizeof(scaled));
+        }
+    }
+    int32_t nonzero = 0;
+    for (int i = 0; i < 8; i++)
+        nonzero |= any[i];
+    if (!nonzero && !pred)
+        return zero_large(coeffs, out, rows, cols, recon, last);
+    return quantize_large(coeffs, out, rows, cols, weights, mult, pred, recon, last);
+}
+
+#undef DCT_CAT0
+#undef DCT_CAT
+#undef DCT_FN
@@ -0,0 +1,365 @@
+/*
+ * Forward DCT kernels
+ */
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "dct.h"
+#include "math-functions.h"
+#include "simd.h"
+
+/* natural order of the coefficients, as indices into the transposed block */
+static const uint8_t natural_index[64] = {
+     0,  1,  8, 16,  9,  2,  3, 10, 17, 24, 32, 25, 18, 11,  4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13,  6,  7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63,
+};
+
+/*
+ * One-dimensional 8-point DCT-II, using the Loeffler-Ligtenberg-Moschytz factorization.
+ * Unscaled, the outputs are sqrt(8) times the orthonormal DCT, so a total scale of 1/64
+ * over both passes yields the normalization of JPEG XL, where the DC coefficient is the mean.
+ */
+static inline void fdct8(float *out, const ptrdiff_t out_stride, const float *in, const ptrdiff_t in_stride,
+                         const float scale) {
+    const float tmp0 = in[0] + in[7 * in_stride];
+    const float tmp7 = in[0] - in[7 * in_stride];
+    const float tmp1 = in[in_stride] + in[6 * in_stride];
+    const float tmp6 = in[in_stride] - in[6 * in_stride];
+    const float tmp2 = in[2 * in_stride] + in[5 * in_stride];
+    const float tmp5 = in[2 * in_stride] - in[5 * in_stride];
+    const float tmp3 = in[3 * in_stride] + in[4 * in_stride];
+    const float tmp4 = in[3 * in_stride] - in[4 * in_stride];
+
+    /* even part */
+    const float tmp10 = tmp0 + tmp3;
+    const float tmp13 = tmp0 - tmp3;
+    const float tmp11 = tmp1 + tmp2;
+    const float tmp12 = tmp1 - tmp2;
+    const float z1 = (tmp12 + tmp13) * 0.541196100f;
+    out[0] = (tmp10 + tmp11) * scale;
+    out[4 * out_stride] = (tmp10 - tmp11) * scale;
+    out[2 * out_stride] = (z1 + tmp13 * 0.765366865f) * scale;
+    out[6 * out_stride] = (z1 - tmp12 * 1.847759065f) * scale;
+
+    /* odd part */
+    const float z5 = (tmp4 + tmp5 + tmp6 + tmp7) * 1.175875602f;
+    const float o1 = (tmp4 + tmp7) * -0.899976223f;
+    const float o2 = (tmp5 + tmp6) * -2.562915447f;
+    const float o3 = (tmp4 + tmp6) * -1.961570560f + z5;
+    const float o4 = (tmp5 + tmp7) * -0.390180644f + z5;
+    out[7 * out_stride] = (tmp4 * 0.298631336f + o1 + o3) * scale;
+    out[5 * out_stride] = (tmp5 * 2.053119869f + o2 + o4) * scale;
+    out[3 * out_stride] = (tmp6 * 3.072711026f + o2 + o3) * scale;
+    out[out_stride] = (tmp7 * 1.501321110f + o1 + o4) * scale;
+}
+
+/*
+ * The value the decoder reconstructs from a quantized luma coefficient, before it divides
+ * by the weight: the default quantization biases pull it toward zero.
+ */
+static inline float dequantize_luma(const int32_t q) {
+    if (hyd_abs(q) == 1)
+        return q * (1.0f - 0.07005449891748593f);
+    return q ? q - 0.145f / q : 0.0f;
+}
+
+/*
+ * Writes the transposed coefficients in block to coeffs in natural order,
+ * quantizing the AC coefficients with a deadzone of |q| < 2.
+ */
+static inline uint32_t quantize_block(XYBEntry coeffs[64], const float block[64], const float weights[64],
+                                      const float mult, const float *pred, float *recon, size_t *last) {
+    uint32_t nz = 0;
+    *last = 0;
+    coeffs[0].f = block[0];
+    if (recon)
+        recon[0] = 0.0f;
+    for (size_t k = 1; k < 64; k++) {
+        const float coeff = pred ? block[natural_index[k]] - pred[k] : block[natural_index[k]];
+        const int32_t q = (int32_t)(coeff * weights[k] * mult);
+        coeffs[k].i = hyd_abs(q) < 2 ? 0 : q;
+        if (recon)
+            recon[k] = dequantize_luma(coeffs[k].i) / (weights[k] * mult);
+        if (coeffs[k].i) {
+            nz++;
+            *last = k;
+        }
+    }
+    return nz;
+}
+
+/*
+ * Stores the LF value and zeroes the AC coefficients of a block that quantize_block
+ * would quantize to all zeros. Rounding is monotonic, so |c| * max_weight * mult < 2
+ * for the largest coefficient c guarantees that every coefficient is inside the deadzone.
+ */
+static inline uint32_t zero_block(XYBEntry coeffs[64], const float dc, float *recon, size_t *last) {
+    coeffs[0].f = dc;
+    memset(coeffs + 1, 0, 63 * sizeof(*coeffs));
+    if (recon)
+        memset(recon, 0, 64 * sizeof(*recon));
+    *last = 0;
+    return 0;
+}
+
+static uint32_t dct_kernel_scalar(XYBEntry coeffs[64], const XYBEntry *block, ptrdiff_t stride,
+                                  const float weights[64], float max_weight, float mult, const float *pred,
+                                  float *recon, size_t *last) {
+    float in[8][8], scratchblock[8][8], out[64];
+    for (size_t y = 0; y < 8; y++) {
+        for (size_t x = 0; x < 8; x++)
+            in[y][x] = block[y * stride + x].f;
+    }
+    /* vertical pass, column x becomes row x of the scratch block */
+    for (size_t x = 0; x < 8; x++)
+        fdct8(scratchblock[x], 1, &in[0][x], 8, 1.0f);
+    /* horizontal pass, horizontal frequency k becomes row k of the output */
+    for (size_t k = 0; k < 8; k++)
+        fdct8(out + k, 8, &scratchblock[0][k], 8, 0.015625f);
+    int any = 0;
+    for (size_t k = 1; k < 64; k++)
+        any |= hyd_abs(out[k]) * max_weight * mult >= 2.0f;
+    if (!any && !pred)
+        return zero_block(coeffs, out[0], recon, last);
+    return quantize_block(coeffs, out, weights, mult, pred, recon, last);
+}
+
+/* 1 / (2 cos((2i + 1) pi / 2n)), which turns the odd half of an n-point DCT into an n/2-point one */
+static const float odd_scale16[8] = {
+    0.502419286f, 0.522498615f, 0.566944035f, 0.646821783f, 0.788154623f, 1.060677686f, 1.722447098f, 5.101148619f,
+};
+
+static const float odd_scale32[16] = {
+    0.500602998f, 0.505470960f, 0.515447310f, 0.531042591f, 0.553103896f, 0.582934968f, 0.622504123f, 0.674808341f,
+    0.744536271f, 0.839349645f, 0.972568238f, 1.169439933f, 1.484164616f, 2.057781010f, 3.407608418f, 10.190008124f,
+};
+
+/*
+ * Ratio of the k-th coefficient of an n-point DCT to the k-th coefficient of
+ * the DCT of its 8-sample means, cos(a) cos(2a) cos(4a) with a = k pi / 2n
+ */
+static const float lf_resample8[1] = {1.0f};
+static const float lf_resample16[2] = {1.0f, 0.901764195f};
+static const float lf_resample32[4] = {1.0f, 0.974886821f, 0.901764195f, 0.787054918f};
+
+/* inverse 1-point, 2-point and 4-point DCTs in the same normalization, indexed by [frequency][sample] */
+static const float lf_idct1[1][1] = {
+    {1.0f},
+};
+
+static const float lf_idct2[2][2] = {
+    {1.0f,  1.0f},
+    {1.0f, -1.0f},
+};
+
+static const float lf_idct4[4][4] = {
+    {1.0f,          1.0f,          1.0f,          1.0f},
+    {1.306562965f,  0.541196100f, -0.541196100f, -1.306562965f},
+    {1.0f,         -1.0f,         -1.0f,          1.0f},
+    {0.541196100f, -1.306562965f,  1.306562965f, -0.541196100f},
+};
+
+/* the tables above for a side of 1, 2 or 4 blocks */
+static const float *const lf_resample[5] = {NULL, lf_resample8, lf_resample16, NULL, lf_resample32};
+static const float *const lf_idct[5] = {NULL, &lf_idct1[0][0], &lf_idct2[0][0], NULL, &lf_idct4[0][0]};
+
+/*
+ * The even outputs of an n-point DCT-II are the half-size DCT of the folded sums, and the odd
+ * outputs are pairwise sums of the half-size DCT of the folded differences, each divided
+ * by twice the cosine of its sample position. Unscaled, like fdct8.
+ */
+static inline void fdct16(float *out, const float *in) {
+    float even[8], odd[8], even_out[8], odd_out[8];
+    for (size_t i = 0; i < 8; i++) {
+        even[i] = in[i] + in[15 - i];
+        odd[i] = (in[i] - in[15 - i]) * odd_scale16[i];
+    }
+    fdct8(even_out, 1, even, 1, 1.0f);
+    fdct8(odd_out, 1, odd, 1, 1.0f);
+    for (size_t k = 0; k < 8; k++)
+        out[2 * k] = even_out[k];
+    /* the DC of the odd half lacks the sqrt(2) that the scaling puts on every other output */
+    out[1] = odd_out[0] * 1.414213562f + odd_out[1];
+    for (size_t k = 1; k < 7; k++)
+        out[2 * k + 1] = odd_out[k] + odd_out[k + 1];
+    out[15] = odd_out[7];
+}
+
+static inline void fdct32(float *out, const float *in) {
+    float even[16], odd[16], even_out[16], odd_out[16];
+    for (size_t i = 0; i < 16; i++) {
+        even[i] = in[i] + in[31 - i];
+        odd[i] = (in[i] - in[31 - i]) * odd_scale32[i];
+    }
+    fdct16(even_out, even);
+    fdct16(odd_out, odd);
+    for (size_t k = 0; k < 16; k++)
+        out[2 * k] = even_out[k];
+    out[1] = odd_out[0] * 1.414213562f + odd_out[1];
+    for (size_t k = 1; k < 15; k++)
+        out[2 * k + 1] = odd_out[k] + odd_out[k + 1];
+    out[31] = odd_out[15];
+}
+
+static inline void fdct_n(float *out, const float *in, const size_t n) {
+    if (n == 8)
+        fdct8(out, 1, in, 1, 1.0f);
+    else if (n == 16)
+        fdct16(out, in);
+    else
+        fdct32(out, in);
+}
+
+/*
+ * Stores the lowest frequencies of the transposed rows-by-cols block as LF values. The decoder
+ * derives those frequencies from the LF values of the covered blocks, so the LF values are
+ * computed as the inverse of that derivation.
+ */
+static void store_lf_values(XYBEntry *coeffs, const float *block, const size_t rows, const size_t cols) {
+    const size_t side_v = rows >> 3;
+    const size_t side_h = cols >> 3;
+    const float *const resample_v = lf_resample[side_v];
+    const float *const resample_h = lf_resample[side_h];
+    const float *const idct_v = lf_idct[side_v];
+    const float *const idct_h = lf_idct[side_h];
+    for (size_t by = 0; by < side_v; by++) {
+        for (size_t bx = 0; bx < side_h; bx++) {
+            float lf = 0.0f;
+            for (size_t fv = 0; fv < side_v; fv++) {
+                for (size_t fh = 0; fh < side_h; fh++)
+                    lf += block[fh * rows + fv] / (resample_v[fv] * resample_h[fh])
+                        * idct_v[fv * side_v + by] * idct_h[fh * side_h + bx];
+            }
+            coeffs[by * side_h + bx].f = lf;
+        }
+    }
+}
+
+/* like zero_block, for a transposed rows-by-cols block that passed the same test outside its LF values */
+static uint32_t zero_large(XYBEntry *coeffs, const float *block, const size_t rows, const size_t cols,
+                           float *recon, size_t *last) {
+    const size_t covered = (rows >> 3) * (cols >> 3);
+    store_lf_values(coeffs, block, rows, cols);
+    memset(coeffs + covered, 0, (rows * cols - covered) * sizeof(*coeffs));
+    if (recon)
+        memset(recon, 0, rows * cols * sizeof(*recon));
+    *last = 0;
+    return 0;
+}
+
+/* Stores the LF values of the transposed rows-by-cols block and quantizes the rest, like quantize_block. */
+static uint32_t quantize_large(XYBEntry *coeffs, const float *block, const size_t rows, const size_t cols,
+                               const float *weights, const float mult, const float *pred, float *recon,
+                               size_t *last) {
+    const size_t side_v = rows >> 3;
+    const size_t side_h = cols >> 3;
+    const size_t log2_ratio = hyd_fllog2(rows / cols);
+    store_lf_values(coeffs, block, rows, cols);
+    if (recon)
+        memset(recon, 0, side_v * side_h * sizeof(*recon));
+
+    /*
+     * Natural order walks the anti-diagonals of a rows-by-rows square, alternating direction,
+     * after the lowest frequencies which take its first side_v * side_h slots. The cols
+     * horizontal frequencies lie on every (rows / cols)-th line of the square.
+     */
+    uint32_t nz = 0;
+    size_t k = side_v * side_h, last_k = 0;
+    for (size_t d = 0; d < 2 * rows - 1; d++) {
+        const size_t lo = d < rows ? 0 : d - rows + 1;
+        const size_t hi = d < rows ? d : rows - 1;
+        for (size_t t = lo; t <= hi; t++) {
+            const size_t line = d & 1 ? t : d - t;
+            const size_t h = line >> log2_ratio;
+            const size_t v = d - line;
+            if (line & ((1 << log2_ratio) - 1) || (h < side_h && v < side_v))
+                continue;
+            const float coeff = pred ? block[h * rows + v] - pred[k] : block[h * rows + v];
+            const int32_t q = (int32_t)(coeff * weights[h * rows + v] * mult);
+            coeffs[k].i = hyd_abs(q) < 2 ? 0 : q;
+            if (recon)
+                recon[k] = dequantize_luma(coeffs[k].i) / (weights[h * rows + v] * mult);
+            nz += !!coeffs[k].i;
+            last_k = coeffs[k].i ? k : last_k;
+            k++;
+        }
+    }
+    *last = last_k;
+
+    return nz;
+}
+
+static uint32_t dct_large_kernel_scalar(XYBEntry *coeffs, const XYBEntry *block, ptrdiff_t stride, size_t rows,
+                                        size_t cols, const float *weights, float max_weight, float mult,
+                                        const float *pred, float *recon, size_t *last) {
+    float in[32], freq[32], scratch[32 * 32], out[32 * 32];
+    const float scale = 1.0f / (rows * cols);
+    /* vertical pass, vertical frequency v of column x goes to scratch[v * cols + x] */
+    for (size_t x = 0; x < cols; x++) {
+        for (size_t y = 0; y < rows; y++)
+            in[y] = block[y * stride + x].f;
+        fdct_n(freq, in, rows);
+        for (size_t v = 0; v < rows; v++)
+            scratch[v * cols + x] = freq[v];
+    }
+    /* horizontal pass, horizontal frequency h becomes row h of the output */
+    const size_t side_v = rows >> 3;
+    const size_t side_h = cols >> 3;
+    int any = 0;
+    for (size_t v = 0; v < rows; v++) {
+        fdct_n(freq, scratch + v * cols, cols);
+        for (size_t h = 0; h < cols; h++) {
+            out[h * rows + v] = freq[h] * scale;
+            /* the frequencies stored as LF values are not part of the all-zero test */
+            if (h >= side_h || v >= side_v)
+                any |= hyd_abs(out[h * rows + v]) * max_weight * mult >= 2.0f;
+        }
+    }
+    if (!any && !pred)
+        return zero_large(coeffs, out, rows, cols, recon, last);
+    return quantize_large(coeffs, out, rows, cols, weights, mult, pred, recon, last);
+}
+
+#if HYD_HAVE_VECTOR_EXT
+/* SSE2 and NEON are baseline wherever they are detected, so this needs no dispatch */
+#define DCT_SUFFIX x8
+#define DCT_TARGET
+#include "dct-template.c"
+#undef DCT_SUFFIX
+#undef DCT_TARGET
+#endif
+
+#if HYD_HAVE_AVX2
+#define DCT_SUFFIX avx2
+#define DCT_TARGET __attribute__((target("avx2")))
+#include "dct-template.c"
+#undef DCT_SUFFIX
+#undef DCT_TARGET
+#endif
+
+HYDDCTQuantKernel hyd_dct_select_kernel(void) {
+#if HYD_HAVE_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return &dct_kernel_avx2;
+#endif
+#if HYD_HAVE_VECTOR_EXT
+    return &dct_kernel_x8;
+#endif
+    return &dct_kernel_scalar;
+}
+
+HYDDCTQuantLargeKernel hyd_dct_select_large_kernel(void) {
+#if HYD_HAVE_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return &dct_large_kernel_avx2;
+#endif
+#if HYD_HAVE_VECTOR_EXT
+    return &dct_large_kernel_x8;
+#endif
+    return &dct_large_kernel_scalar;
+}
@@ -0,0 +1,51 @@
+#ifndef HYDRIUM_DCT_H_
+#define HYDRIUM_DCT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "xyb.h"
+
+/*
+ * Transforms the 8x8 block at block, with a row stride of stride entries, and
+ * quantizes it in one pass, storing the 64 coefficients to coeffs in natural order.
+ * The DC coefficient coeffs[0] is left as a float; the AC coefficients become
+ * integers, using weights[k] * mult as the multiplier of coefficient k.
+ * max_weight is the largest of weights[1] through weights[63]; blocks whose AC
+ * coefficients all quantize to zero under it skip the per-coefficient work.
+ * If pred is not NULL, pred[k] is subtracted from AC coefficient k before it is quantized,
+ * and the block always takes the per-coefficient path. If recon is not NULL, recon[k]
+ * receives AC coefficient k as the decoder dequantizes it in the luma channel.
+ * Returns the number of nonzero AC coefficients, and stores the natural index of
+ * the last one in *last, or zero if there are none.
+ */
+typedef uint32_t (*HYDDCTQuantKernel)(XYBEntry coeffs[64], const XYBEntry *block, ptrdiff_t stride,
+                                      const float weights[64], float max_weight, float mult, const float *pred,
+                                      float *recon, size_t *last);
+
+/*
+ * Transforms the rows-by-cols block at block, where rows is 16 or 32 and cols is 8, 16 or 32
+ * but no more than rows, and quantizes it into coeffs in natural order, like a HYDDCTQuantKernel.
+ * The lowest frequencies are not coded, so the first (rows / 8) * (cols / 8) entries of coeffs
+ * instead receive, as floats, the LF values of the covered 8x8 blocks in raster order.
+ * weights is indexed like the transposed coefficients, cols rows of rows entries each,
+ * and max_weight is the largest of its entries outside the lowest frequencies.
+ * pred and recon are indexed like coeffs, and their entries for the LF values are unused.
+ */
+typedef uint32_t (*HYDDCTQuantLargeKernel)(XYBEntry *coeffs, const XYBEntry *block, ptrdiff_t stride, size_t rows,
+                                           size_t cols, const float *weights, float max_weight, float mult,
+                                           const float *pred, float *recon, size_t *last);
+
+/**
+ * @brief Pick the fastest DCT kernel supported by the running CPU.
+ * @return HYDDCTQuantKernel a kernel that is bit-exact with the portable scalar one.
+ */
+HYDDCTQuantKernel hyd_dct_select_kernel(void);
+
+/**
+ * @brief Pick the fastest kernel for the transforms larger than 8x8 supported by the running CPU.
+ * @return HYDDCTQuantLargeKernel a kernel that is bit-exact with the portable scalar one.
+ */
+HYDDCTQuantLargeKernel hyd_dct_select_large_kernel(void);
+
+#endif /* HYDRIUM_DCT_H_ */
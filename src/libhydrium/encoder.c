@@ -11,10 +11,6 @@
 #include "math-functions.h"
 #include "memory.h"
 
-typedef struct IntPos {
-    uint8_t x, y;
-} IntPos;
-
 static const uint8_t level10_header[49] = {
     0x00, 0x00, 0x00, 0x0c,  'J',  'X',  'L',  ' ',
     0x0d, 0x0a, 0x87, 0x0a, 0x00, 0x00, 0x00, 0x14,
@@ -24,27 +20,6 @@ static const uint8_t level10_header[49] = {
     0x00, 0x00, 0x00, 0x00,  'j',  'x',  'l',  'c',
 };
 
-static const float cosine_lut[7][8] = {
-    {0.17338, 0.146984, 0.0982119, 0.0344874, -0.0344874, -0.0982119, -0.146984, -0.17338},
-    {0.16332, 0.0676495, -0.0676495, -0.16332, -0.16332, -0.0676495, 0.0676495, 0.16332},
-    {0.146984, -0.0344874, -0.17338, -0.0982119, 0.0982119, 0.17338, 0.0344874, -0.146984},
-    {0.125, -0.125, -0.125, 0.125, 0.125, -0.125, -0.125, 0.125},
-    {0.0982119, -0.17338, 0.0344874, 0.146984, -0.146984, -0.0344874, 0.17338, -0.0982119},
-    {0.0676495, -0.16332, 0.16332, -0.0676495, -0.0676495, 0.16332, -0.16332, 0.0676495},
-    {0.0344874, -0.0982119, 0.146984, -0.17338, 0.17338, -0.146984, 0.0982119, -0.0344874},
-};
-
-static const IntPos natural_order[64] = {
-    {0, 0}, {1, 0}, {0, 1}, {0, 2}, {1, 1}, {2, 0}, {3, 0}, {2, 1},
-    {1, 2}, {0, 3}, {0, 4}, {1, 3}, {2, 2}, {3, 1}, {4, 0}, {5, 0},
-    {4, 1}, {3, 2}, {2, 3}, {1, 4}, {0, 5}, {0, 6}, {1, 5}, {2, 4},
-    {3, 3}, {4, 2}, {5, 1}, {6, 0}, {7, 0}, {6, 1}, {5, 2}, {4, 3},
-    {3, 4}, {2, 5}, {1, 6}, {0, 7}, {1, 7}, {2, 6}, {3, 5}, {4, 4},
-    {5, 3}, {6, 2}, {7, 1}, {7, 2}, {6, 3}, {5, 4}, {4, 5}, {3, 6},
-    {2, 7}, {3, 7}, {4, 6}, {5, 5}, {6, 4}, {7, 3}, {7, 4}, {6, 5},
-    {5, 6}, {4, 7}, {5, 7}, {6, 6}, {7, 5}, {7, 6}, {6, 7}, {7, 7},
-};
-
 static const size_t coeff_freq_context[64] = {
      0,  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14,
     15, 15, 16, 16, 17, 17, 18, 18, 19, 19, 20, 20, 21, 21, 22, 22,
@@ -87,7 +62,59 @@ static const float hf_quant_weights[3][64] = {
     },
 };
 
-static const uint16_t hf_mult = 5;
+/*
+ * Distance bands of the default DCT16, DCT32, DCT16X8 and DCT32X16 quantization tables:
+ * the first weight, then the ratio of each band to the previous one, stored the way the
+ * decoder reads them. DCT8X16 and DCT16X32 share the tables of their transposes.
+ */
+static const float dct16_bands[3][7] = {
+    {8996.8725711814115328f, -1.3000777393353804f, -0.49424529824571225f, -0.439093774457103443f,
+        -0.6350101832695744f, -0.90177264050827612f, -1.6162099239887414f},
+    {3191.48366296844234752f, -0.67424582104194355f, -0.80745813428471001f, -0.44925837484843441f,
+        -0.35865440981033403f, -0.31322389111877305f, -0.37655709856185163f},
+    {157.37483587580457f, -0.0098826225132004f, -0.48212702588085046f, -0.46401130213526375f,
+        -0.45282633447802357f, -0.63466165640059297f, -0.66940845052447957f},
+};
+
+static const float dct32_bands[3][8] = {
+    {15718.40830982518931456f, -1.025f, -0.98f, -0.9012f, -0.4f, -0.48819395464f, -0.421064f, -0.27f},
+    {7305.7636810695983104f, -0.8041958212306401f, -0.7633036457487539f, -0.55660379990111464f,
+        -0.49785304658857626f, -0.43699592683512467f, -0.40180866526242109f, -0.27321683125358037f},
+    {3803.53173721215041536f, -3.060733579805728f, -2.0413270132490346f, -2.0235650159727417f,
+        -0.5495389509954993f, -0.4f, -0.4f, -0.3f},
+};
+
+static const float dct16x8_bands[3][7] = {
+    {7240.7734393502f, -0.7f, -0.7f, -0.2f, -0.2f, -0.2f, -0.5f},
+    {1448.15468787004f, -0.5f, -0.5f, -0.5f, -0.2f, -0.2f, -0.2f},
+    {506.854140754517f, -1.4f, -0.2f, -0.5f, -0.5f, -1.5f, -3.6f},
+};
+
+static const float dct32x16_bands[3][8] = {
+    {13844.97076442300573f, -0.97113799999999995f, -0.658f, -0.42026f, -0.22712f, -0.2206f, -0.226f, -0.6f},
+    {4798.964084220744293f, -0.61125308982767057f, -0.83770786552491361f, -0.79014862079498627f,
+        -0.2692727459704829f, -0.38272769465388551f, -0.22924222653091453f, -0.20719098826199578f},
+    {1807.236946760964614f, -1.2f, -1.2f, -0.7f, -0.7f, -0.7f, -0.4f, -0.5f},
+};
+
+/* AC strategies, numbered as in the bitstream, where DCT16X8 is 16 pixels tall and 8 wide */
+#define ACS_DCT8 0
+#define ACS_DCT16 4
+#define ACS_DCT32 5
+#define ACS_DCT16X8 6
+#define ACS_DCT8X16 7
+#define ACS_DCT32X16 10
+#define ACS_DCT16X32 11
+/* marks the blocks of a varblock other than its top-left one */
+#define ACS_COVERED 0xFF
+
+/* log2 of the width and of the height in blocks, and the order class that selects the block context */
+static const uint8_t acs_log2_width[12] = {0, 0, 0, 0, 1, 2, 0, 1, 0, 2, 1, 2};
+static const uint8_t acs_log2_height[12] = {0, 0, 0, 0, 1, 2, 1, 0, 2, 0, 2, 1};
+static const uint8_t acs_order[12] = {0, 1, 1, 1, 2, 3, 4, 4, 5, 5, 6, 6};
+
+/* inverse of the default LF dequantization multipliers */
+static const float lf_quant_inv[3] = {4096.f, 512.f, 256.f};
 static const uint64_t zero64 = 0;
 static const void *const zerobuf = &zero64;
 static const U32Table size_header_u32 = {
@@ -109,12 +136,29 @@ static const U32Table quant_lf_table = {
 static const uint32_t lf_ma_tree[][2] = {
     {1, 0}, {2, 5}, {3, 0}, {4, 0}, {5, 0},
 };
+/*
+ * HF metadata tree, nodes in breadth-first order: the channel splits off the CfL factors
+ * and the sharpness, and the row splits BlockInfo into AC strategies and HfMul.
+ * Each leaf predicts zero and gets its own context: CfL 0, sharpness 1, HfMul 2, strategy 3.
+ */
+static const uint32_t hf_meta_ma_tree[][2] = {
+    {1, 1}, {0, 2},
+    {1, 1}, {0, 4},
+    {1, 0}, {2, 0}, {3, 0}, {4, 0}, {5, 0},
+    {1, 0}, {2, 0}, {3, 0}, {4, 0}, {5, 0},
+    {1, 3}, {0, 0},
+    {1, 0}, {2, 0}, {3, 0}, {4, 0}, {5, 0},
+    {1, 0}, {2, 0}, {3, 0}, {4, 0}, {5, 0},
+};
+static const uint8_t hf_meta_cluster_map[4] = {0, 1, 2, 3};
 static const U32Table toc_table = {
     .cpos = {0, 1024, 17408, 4211712},
     .upos = {10, 14, 22, 30},
 };
 
 extern const uint8_t hf_cluster_map[7425];
+extern const float hf_fixed_distances[4];
+extern const uint16_t hf_fixed_frequencies[4][45][64];
 
 static HYDStatusCode write_header(HYDEncoder *encoder) {
 
@@ -366,6 +410,739 @@ HYDStatusCode hyd_populate_lf_group(HYDEncoder *encoder, HYDLFGroup **lf_group_p
     return HYD_OK;
 }
 
+/* Newton iterations from an exponent-halving guess, like the approximations in math-functions.h */
+static float approx_sqrtf(const float x) {
+    if (x <= 0.0f)
+        return 0.0f;
+    union { float f; uint32_t i; } z = { .f = x };
+    z.i = (z.i >> 1) + 0x1FC00000;
+    for (int i = 0; i < 4; i++)
+        z.f = 0.5f * (z.f + x / z.f);
+    return z.f;
+}
+
+/*
+ * Evaluate a default quantization table the way the decoder does, interpolating
+ * geometrically between the distance bands along the radial frequency, which is
+ * normalized to the same range along both sides of a rectangular table.
+ */
+static void fill_band_weights(float *weights, const size_t height, const size_t width, const float *bands,
+                              const size_t num_bands, const float scale) {
+    float band[8];
+    band[0] = bands[0];
+    for (size_t i = 1; i < num_bands; i++)
+        band[i] = band[i - 1] * (bands[i] > 0.0f ? 1.0f + bands[i] : 1.0f / (1.0f - bands[i]));
+    const float range = (num_bands - 1) / (1.414213562f + 1e-6f);
+    const float step_y = range / (height - 1);
+    const float step_x = range / (width - 1);
+    for (size_t y = 0; y < height; y++) {
+        for (size_t x = 0; x < width; x++) {
+            const float dy = y * step_y;
+            const float dx = x * step_x;
+            const float distance = approx_sqrtf(dx * dx + dy * dy);
+            const size_t i = hyd_min((size_t)distance, num_bands - 2);
+            const float ratio = hyd_approx_log2f(band[i + 1] / band[i]);
+            weights[y * width + x] = band[i] * hyd_approx_exp2f((distance - i) * ratio) * scale;
+        }
+    }
+}
+
+/* the largest weight of a table outside its lowest (height / 8) * (width / 8) frequencies, which are not coded */
+static float max_coded_weight(const float *weights, const size_t height, const size_t width) {
+    float max = 0.0f;
+    for (size_t h = 0; h < height; h++) {
+        for (size_t v = h < height >> 3 ? width >> 3 : 0; v < width; v++)
+            max = weights[h * width + v] > max ? weights[h * width + v] : max;
+    }
+    return max;
+}
+
+void hyd_init_quantizer(HYDEncoder *encoder, const float distance) {
+    /*
+     * The HF quantizer scales as 1 / distance. The integer HfMul takes the bulk of it
+     * and globalScale takes the remainder. HfMul is kept at 10 or more so that
+     * adaptive_hf_mult has room to lower it for flat blocks. 10 rather than 8 puts distance 1
+     * at globalScale = 16384, where quantLF = 8 keeps the LF precision at exactly 2.
+     */
+    const float hf_scale = 5.0f / distance;
+    const uint32_t hf_mult = hyd_clamp((uint32_t)(hf_scale + 0.5f), 10, 255);
+    const uint32_t global_scale = hyd_clamp((uint32_t)(32768.0f * hf_scale / hf_mult + 0.5f), 1, 65536);
+    /*
+     * LF artifacts show up as blocking, so the LF precision globalScale * quantLF / 65536
+     * falls more slowly than the HF one, as lf_target = 4 / (1 + distance), which is 2 at distance 1
+     */
+    const float lf_target = 4.0f / (1.0f + distance);
+    const uint32_t quant_lf = hyd_max((uint32_t)(lf_target * 65536.0f / global_scale + 0.5f), 1);
+
+    encoder->hf_mult = hf_mult;
+    encoder->global_scale = global_scale;
+    encoder->quant_lf = quant_lf;
+    for (int c = 0; c < 3; c++) {
+        encoder->lf_scale[c] = (float)(global_scale * quant_lf) / 65536.0f * lf_quant_inv[c];
+        for (int k = 0; k < 64; k++)
+            encoder->hf_weights[c][k] = hf_quant_weights[c][k] * (global_scale / 32768.0f);
+        /* hf_quant_weights already carry the factor of 1/2 and the 1.25 of x_qm_scale */
+        const float table_scale = (global_scale / 65536.0f) * (c ? 1.0f : 1.25f);
+        fill_band_weights(encoder->hf_weights16[c], 16, 16, dct16_bands[c], 7, table_scale);
+        fill_band_weights(encoder->hf_weights32[c], 32, 32, dct32_bands[c], 8, table_scale);
+        fill_band_weights(encoder->hf_weights16x8[c], 8, 16, dct16x8_bands[c], 7, table_scale);
+        fill_band_weights(encoder->hf_weights32x16[c], 16, 32, dct32x16_bands[c], 8, table_scale);
+        encoder->hf_weight_max[c] = max_coded_weight(encoder->hf_weights[c], 8, 8);
+        encoder->hf_weight_max16[c] = max_coded_weight(encoder->hf_weights16[c], 16, 16);
+        encoder->hf_weight_max32[c] = max_coded_weight(encoder->hf_weights32[c], 32, 32);
+        encoder->hf_weight_max16x8[c] = max_coded_weight(encoder->hf_weights16x8[c], 8, 16);
+        encoder->hf_weight_max32x16[c] = max_coded_weight(encoder->hf_weights32x16[c], 16, 32);
+    }
+}
+
+/* gradient energy of the luma of an 8x8 block, summed over its 112 inner differences */
+static float block_activity(const XYBEntry *block, const ptrdiff_t stride) {
+    float activity = 0.0f;
+    for (int y = 0; y < 8; y++) {
+        const XYBEntry *row = block + y * stride;
+        for (int x = 0; x < 7; x++)
+            activity += hyd_abs(row[x + 1].f - row[x].f);
+        if (y == 7)
+            break;
+        for (int x = 0; x < 8; x++)
+            activity += hyd_abs(row[x + stride].f - row[x].f);
+    }
+    return activity;
+}
+
+/*
+ * Pick the HfMul of a varblock from the mean activity of its blocks.
+ * Flat blocks carry little visible detail, so they get down to half the multiplier,
+ * which zeroes most of their noise-level coefficients. Three levels keep the
+ * HfMul field cheap to code: a block is flat below a mean step of about 1/112
+ * and smooth below 1/56.
+ */
+static uint8_t adaptive_hf_mult(const HYDEncoder *encoder, const float activity) {
+    const float scale = activity < 1.0f ? 0.5f : activity < 2.0f ? 0.75f : 1.0f;
+    return (uint8_t)hyd_clamp(encoder->hf_mult * scale * encoder->rc.scale + 0.5f, 1.0f, 255.0f);
+}
+
+/* rough bit cost of the quantized coefficients from start to end, in natural order */
+static float coeff_cost(const XYBEntry *coeffs, const size_t start, const size_t end) {
+    /* branch-free: most of the coefficients are zero, but not predictably so */
+    uint32_t cost = 0;
+    for (size_t k = start; k < end; k++) {
+        const uint32_t q = hyd_abs(coeffs[k].i);
+        cost += (2 + hyd_fllog2(q)) & -(uint32_t)!!q;
+    }
+    return (float)cost;
+}
+
+/*
+ * Rate control
+ *
+ * Sizes are modeled as complexity * D^-0.55, where D is the effective distance, the distance of
+ * the quantizer divided by the scale applied on top of every HfMul. The complexity of what was
+ * already encoded is known, and that of the rest of the LF group is predicted from the LF of
+ * every row and the HF of one block row per strip. Their average per pixel is taken to hold for
+ * the rest of the image, and D is set so that it fills what is left of the budget. The quantizer
+ * is picked from it while the frame header is yet to be written, which in tiled mode is at every
+ * tile, and the scale steers D from strip to strip otherwise. The prediction of each strip is
+ * refined with its full luma cost before it is quantized, and estimate_varblock_bits accounts for
+ * it after. At the end of an LF group, the estimates are replaced by the LF bits as written and by
+ * the HF bits as written or, while the HF stream stays open, by its entropy estimate.
+ *
+ * The target size is a ceiling. D is planned against what is left of the budget less a margin,
+ * a share of the bits not yet written that covers the errors of the estimates and shrinks to
+ * nothing as the written bits come in. The share follows the error of each LF group, measured
+ * against what the budget allots to it, and decays slowly back toward where it starts: RC_MARGIN,
+ * or twice that with the fixed histograms, whose fit varies the most between images. The last
+ * strip of the image may not raise the scale, as nothing follows it to make up for an error.
+ * Headers are charged as they are written, and the rest of the frame in progress is reserved, as
+ * its HF global section and TOC are only written at the very end. They cost about what they did in
+ * the last frame, or in one-frame mode a fixed guess, twice as large with the fixed histograms,
+ * which are written out in full. Once the budget is used up, D goes as high as the clamps allow.
+ */
+#define RC_EXPONENT 0.55f
+#define RC_MARGIN 0.08f
+#define RC_FRAME_RESERVE 8192.0f
+
+/* bits in a writer so far, including any that went to its overflow */
+static size_t working_bits(const HYDBitWriter *bw) {
+    return ((bw->buffer_pos + bw->overflow_pos) << 3) + bw->cache_bits;
+}
+
+static float rc_pow(const float x, const float y) {
+    return hyd_approx_exp2f(y * hyd_approx_log2f(x));
+}
+
+float hyd_init_rate_control(HYDEncoder *encoder) {
+    const HYDImageMetadata *metadata = &encoder->metadata;
+    /* the fixed histograms are written out in full, and fit some images much worse than others */
+    const int fixed_histograms = encoder->one_frame && metadata->fixed_histograms && !metadata->prefix_codes;
+    encoder->rc = (HYDRateControl) { .scale = 1.0f, .hf_ratio = 1.8f, .lf_ratio = 1.15f, .calibration = 1.0f,
+        .frame_overhead = fixed_histograms ? 2.0f * RC_FRAME_RESERVE : RC_FRAME_RESERVE,
+        .margin = fixed_histograms ? 2.0f * RC_MARGIN : RC_MARGIN };
+    if (!metadata->target_size) {
+        encoder->rc.distance = metadata->distance ? metadata->distance : 1.0f;
+        return encoder->rc.distance;
+    }
+    encoder->rc.budget = 8.0f * metadata->target_size;
+    /*
+     * Photographic content takes about 1.2 bpp at distance 1, and the size goes as distance^-0.55
+     * above that, but flattens out to about distance^-0.3 below it.
+     */
+    const float bpp = encoder->rc.budget / ((float)metadata->width * metadata->height);
+    const float log_ratio = hyd_approx_log2f(1.2f / bpp);
+    encoder->rc.distance = hyd_clamp(hyd_approx_exp2f((log_ratio < 0.0f ? 3.2f : 1.8f) * log_ratio), 0.1f, 25.0f);
+    encoder->rc.prior = bpp * rc_pow(encoder->rc.distance, RC_EXPONENT);
+    return encoder->rc.distance;
+}
+
+static float block_mean(const XYBEntry *block, const ptrdiff_t stride) {
+    float sum = 0.0f;
+    for (size_t y = 0; y < 8; y++) {
+        for (size_t x = 0; x < 8; x++)
+            sum += block[y * stride + x].f;
+    }
+    return sum * (1.0f / 64.0f);
+}
+
+/*
+ * Pass over the LF residuals of block row vy, as the LF predictor forms them. Without lengths,
+ * count their tokens, and with the code lengths of the tokens, return the bits they take.
+ */
+static float lf_row_bits(const HYDEncoder *encoder, const HYDLFGroup *lf_group, const size_t vy,
+                         uint32_t *counts, const float *lengths) {
+    const size_t lf_pad_w = lf_group->lf_varblock_width << 3;
+    float bits = 0.0f;
+    for (int c = 0; c < 3; c++) {
+        int32_t w = 0, nw = 0;
+        for (size_t vx = 0; vx < lf_group->lf_varblock_width; vx++) {
+            const XYBEntry *const block = encoder->xyb[c] + vy * 8 * lf_pad_w + (vx << 3);
+            const int32_t q = (int32_t)(block_mean(block, lf_pad_w) * encoder->lf_scale[c]);
+            const int32_t n = vy ? (int32_t)(block_mean(block - 8 * lf_pad_w, lf_pad_w) * encoder->lf_scale[c]) : q;
+            if (!vx)
+                w = nw = n;
+            const int32_t v = hyd_clamp(w + n - nw, hyd_min(w, n), hyd_max(w, n));
+            const uint32_t packed = hyd_pack_signed(q - v);
+            /* like a hybrid uint with a split of 16 and no mantissa bits in the token */
+            const int extra = packed < 16 ? 0 : hyd_fllog2(packed);
+            const size_t token = packed < 16 ? packed : 12 + extra;
+            if (lengths)
+                bits += lengths[token] + extra;
+            else
+                counts[token]++;
+            w = q;
+            nw = n;
+        }
+    }
+    return bits;
+}
+
+/*
+ * Sample the HF and LF costs of every strip of the LF group at the current quantizer. The HF cost
+ * is the luma cost of select_ac_strategies over the second block row of the strip, or its only
+ * one, and the LF cost is the entropy of the LF residuals over all of its rows.
+ */
+static void sample_strip_costs(const HYDEncoder *encoder, const HYDLFGroup *lf_group, float *hf_cost,
+                               float *lf_cost) {
+    XYBEntry scratch[64];
+    uint32_t counts[48] = { 0 };
+    float lengths[48];
+    size_t last;
+    const size_t vbw = lf_group->lf_varblock_width;
+    const size_t vbh = lf_group->lf_varblock_height;
+    const size_t lf_pad_w = vbw << 3;
+    for (size_t vy0 = 0; vy0 < vbh; vy0 += 4) {
+        const size_t strip_h = hyd_min(vbh - vy0, 4);
+        const size_t vy = vy0 + (strip_h > 1);
+        float hf = 0.0f;
+        for (size_t vx = 0; vx < vbw; vx++) {
+            const XYBEntry *const block = encoder->xyb[1] + vy * 8 * lf_pad_w + (vx << 3);
+            const uint8_t mult = adaptive_hf_mult(encoder, block_activity(block, lf_pad_w));
+            encoder->dct_kernel(scratch, block, lf_pad_w, encoder->hf_weights[1], encoder->hf_weight_max[1],
+                mult, NULL, NULL, &last);
+            hf += coeff_cost(scratch, 1, last + 1) + 1.0f;
+        }
+        hf_cost[vy0 >> 2] = hf * strip_h;
+        for (size_t y = vy0; y < vy0 + strip_h; y++)
+            lf_row_bits(encoder, lf_group, y, counts, NULL);
+    }
+    uint32_t total = 0;
+    for (size_t t = 0; t < hyd_array_size(counts); t++)
+        total += counts[t];
+    const float log_total = hyd_approx_log2f((float)total);
+    for (size_t t = 0; t < hyd_array_size(counts); t++)
+        lengths[t] = counts[t] ? log_total - hyd_approx_log2f((float)counts[t]) : 0.0f;
+    for (size_t vy0 = 0; vy0 < vbh; vy0 += 4) {
+        const size_t strip_h = hyd_min(vbh - vy0, 4);
+        lf_cost[vy0 >> 2] = 0.0f;
+        for (size_t y = vy0; y < vy0 + strip_h; y++)
+            lf_cost[vy0 >> 2] += lf_row_bits(encoder, lf_group, y, NULL, lengths);
+    }
+}
+
+/*
+ * The effective distance that fills what is left of the budget, given the complexity still
+ * ahead in the LF group, from pixels of it that are not yet accounted for. The pixels beyond
+ * the LF group are taken at the average so far, which leans on the prior of the photographic
+ * model until a quarter of the image has been seen.
+ */
+static float rate_control_distance(const HYDEncoder *encoder, const float complexity, const size_t pixels) {
+    const HYDRateControl *rc = &encoder->rc;
+    const size_t total = encoder->metadata.width * encoder->metadata.height;
+    const size_t remaining = hyd_max(total - rc->pixels, pixels);
+    const float prior_pixels = 0.25f * total;
+    const float per_pixel = (rc->complexity + complexity + rc->prior * prior_pixels) /
+        (rc->pixels + pixels + prior_pixels);
+    const float ahead = complexity + per_pixel * (remaining - pixels);
+    const float left = rc->budget - rc->spent - rc->frame_overhead - rc->margin * (rc->budget - rc->written);
+    /* past the budget, anything above the clamps of the quantizer will do */
+    if (left < 1.0f)
+        return 1000.0f;
+    return rc_pow(ahead / left, 1.0f / RC_EXPONENT);
+}
+
+static void rate_control_set_scale(HYDEncoder *encoder, const float distance) {
+    encoder->rc.scale = hyd_clamp(encoder->rc.distance / distance, 1.0f / encoder->hf_mult,
+        255.0f / encoder->hf_mult);
+}
+
+/*
+ * Predict the LF group from a sample, picking the quantizer if it is not written yet,
+ * and set the scale to the effective distance that fits the budget.
+ */
+static void rate_control_begin_group(HYDEncoder *encoder, const HYDLFGroup *lf_group, float *hf_cost,
+                                     float *lf_cost) {
+    HYDRateControl *rc = &encoder->rc;
+    const size_t strips = (lf_group->lf_varblock_height + 3) >> 2;
+    const size_t group_pixels = lf_group->lf_group_width * lf_group->lf_group_height;
+    float distance, prev_x = 0.0f, prev_g = 0.0f;
+    for (int i = 0; ; i++) {
+        sample_strip_costs(encoder, lf_group, hf_cost, lf_cost);
+        float hf = 0.0f, lf = 0.0f;
+        for (size_t k = 0; k < strips; k++) {
+            hf += hf_cost[k];
+            lf += lf_cost[k];
+        }
+        rc->sample_distance = rc->distance / rc->scale;
+        distance = rate_control_distance(encoder, (rc->hf_ratio * hf + rc->lf_ratio * lf) *
+            rc_pow(rc->sample_distance, RC_EXPONENT), group_pixels);
+        if (encoder->tiles_sent || i == 3)
+            break;
+        /*
+         * The exponent only holds locally, so the quantizer is picked by the secant method,
+         * in the log domain, on the distance that the sample at each distance asks for.
+         */
+        const float x = hyd_approx_log2f(rc->distance);
+        const float g = hyd_approx_log2f(distance) - x;
+        if (hyd_abs(g) < 0.2f)
+            break;
+        float next = x + g;
+        if (i && prev_g != g)
+            next = x - g * (x - prev_x) / (g - prev_g);
+        prev_x = x;
+        prev_g = g;
+        rc->distance = hyd_clamp(hyd_approx_exp2f(next), 0.1f, 25.0f);
+        rc->scale = 1.0f;
+        hyd_init_quantizer(encoder, rc->distance);
+    }
+    rate_control_set_scale(encoder, distance);
+}
+
+/*
+ * Refine the prediction of strip k with its luma cost, measured at the current scale,
+ * and scale its HfMul to meet the budget.
+ */
+static void rate_control_strip(HYDEncoder *encoder, const HYDLFGroup *lf_group, const float *hf_cost,
+                               const float *lf_cost, const float *cost, const uint8_t *ac_strategy,
+                               uint8_t *hf_mult, const size_t k, const size_t strip_blocks) {
+    HYDRateControl *rc = &encoder->rc;
+    const size_t strips = (lf_group->lf_varblock_height + 3) >> 2;
+    const float scale = rc->scale;
+    float luma_cost = 0.0f, ahead = 0.0f;
+    for (size_t i = 0; i < strip_blocks; i++)
+        luma_cost += cost[i];
+    for (size_t j = k + 1; j < strips; j++)
+        ahead += rc->hf_ratio * hf_cost[j] + rc->lf_ratio * lf_cost[j];
+    const float complexity = ahead * rc_pow(rc->sample_distance, RC_EXPONENT) +
+        (rc->hf_ratio * luma_cost + rc->lf_ratio * lf_cost[k]) * rc_pow(rc->distance / scale, RC_EXPONENT);
+    const size_t pixels = lf_group->lf_group_width * lf_group->lf_group_height - rc->group_pixels;
+    rate_control_set_scale(encoder, rate_control_distance(encoder, complexity, pixels));
+    /*
+     * The strips ahead were sampled at a scale that may have drifted since, so it rises gradually,
+     * but it drops at once, as the budget is a ceiling. Nothing follows the last strip of the image
+     * to make up for an error, so that one does not rise at all.
+     */
+    const int last_strip = k + 1 == strips
+        && encoder->metadata.width * encoder->metadata.height - rc->pixels <= pixels;
+    rc->scale = hyd_min(rc->scale, (last_strip ? 1.0f : 1.33f) * scale);
+    const float factor = rc->scale / scale;
+    for (size_t i = 0; i < strip_blocks; i++) {
+        if (ac_strategy[i] != ACS_COVERED)
+            hf_mult[i] = (uint8_t)hyd_clamp(hf_mult[i] * factor + 0.5f, 1.0f, 255.0f);
+    }
+    rc->strip_luma = luma_cost * rc_pow(factor, RC_EXPONENT);
+}
+
+/*
+ * Rough HF size of a varblock, fitted over photographic and synthetic images at distances
+ * 0.1 to 16, where it lands within about 10% of the coded size: half a bit per coded zero, plus
+ * about three per non-zero and one and a half per bit of magnitude, but only one past the
+ * magnitudes of eight and up, whose tokens are shared by ranges of values. Prefix codes cannot go
+ * below a whole bit per zero, and the fixed histograms, not being counted from the image, spend
+ * about as much on a zero and three times as much on a varblock with none of them coded.
+ */
+static float estimate_varblock_bits(const HYDEncoder *encoder, const HYDLFGroup *lf_group, const int c,
+                                    const size_t vx, const size_t vy, const uint8_t strategy,
+                                    const uint32_t nz, const size_t last) {
+    const int fixed_histograms = encoder->one_frame && encoder->metadata.fixed_histograms
+        && !encoder->metadata.prefix_codes;
+    if (!nz)
+        return fixed_histograms ? 1.5f : 0.55f;
+    const size_t width = 1 << acs_log2_width[strategy];
+    const size_t height = 1 << acs_log2_height[strategy];
+    const float zero_bits = encoder->metadata.prefix_codes ? 1.0f : fixed_histograms ? 0.9f : 0.45f;
+    float bits = 0.25f + zero_bits * ((float)(last + 1 - (width * height)) - nz);
+    for (size_t dy = 0; dy < height; dy++) {
+        for (size_t dx = 0; dx < width; dx++) {
+            const XYBEntry *slot = encoder->xyb[c] + (((vy + dy) * lf_group->lf_varblock_width + vx + dx) << 6);
+            const size_t end = width * height == 1 ? last + 1 : 64;
+            for (size_t k = 1; k < end; k++) {
+                if (!slot[k].i)
+                    continue;
+                const int e = hyd_fllog2(hyd_abs(slot[k].i));
+                bits += e < 3 ? 3.1f + 1.6f * e : 6.3f + (float)e;
+            }
+        }
+    }
+    return bits;
+}
+
+/* Account for a quantized strip, with the HF bits of its varblocks as estimated. */
+static void rate_control_account(HYDEncoder *encoder, const float lf_cost, const size_t strip_pixels,
+                                 const float estimate) {
+    HYDRateControl *rc = &encoder->rc;
+    const float hf_bits = estimate * rc->calibration;
+    const float lf_bits = rc->lf_ratio * lf_cost;
+    rc->hf_sum += hf_bits;
+    rc->luma_sum += rc->strip_luma;
+    rc->hf_ratio = rc->hf_sum / rc->luma_sum;
+    rc->complexity += (hf_bits + lf_bits) * rc_pow(rc->distance / rc->scale, RC_EXPONENT);
+    rc->spent += hf_bits + lf_bits;
+    rc->pixels += strip_pixels;
+    rc->group_pixels += strip_pixels;
+    rc->group_hf += hf_bits;
+    rc->group_hf_estimate += estimate;
+    rc->group_lf += lf_bits;
+    rc->group_lf_cost += lf_cost;
+}
+
+/* Charge bits written outside of the LF groups. */
+static void rate_control_overhead(HYDEncoder *encoder, const float bits) {
+    HYDRateControl *rc = &encoder->rc;
+    rc->spent += bits;
+    rc->written += bits;
+    rc->complexity += bits * rc_pow(rc->distance / rc->scale, RC_EXPONENT);
+}
+
+/* Replace the estimates made for the LF group by the sizes as measured. */
+static void rate_control_end_group(HYDEncoder *encoder, const float lf_bits, const float hf_bits) {
+    HYDRateControl *rc = &encoder->rc;
+    const float error = lf_bits - rc->group_lf + hf_bits - rc->group_hf;
+    rc->spent += error;
+    rc->written = rc->spent;
+    /*
+     * An image that is hard to predict stays so, and an estimate far too high is as likely to be
+     * followed by one far too low, so the margin keeps up with the error either way, relative to
+     * the share of the budget of the pixels it was made for, and only lets go of it slowly.
+     */
+    const float total = (float)encoder->metadata.width * encoder->metadata.height;
+    const float share = rc->budget * rc->group_pixels / total;
+    rc->margin = hyd_clamp(hyd_max(hyd_abs(error) / share, 0.85f * rc->margin), RC_MARGIN, 0.5f);
+    rc->complexity += error * rc_pow(rc->distance / rc->scale, RC_EXPONENT);
+    rc->lf_sum += lf_bits;
+    rc->lf_cost_sum += rc->group_lf_cost;
+    if (rc->lf_cost_sum > 0.0f)
+        rc->lf_ratio = rc->lf_sum / rc->lf_cost_sum;
+    if (rc->group_hf_estimate > 0.0f)
+        rc->calibration = 0.5f * (rc->calibration + hf_bits / rc->group_hf_estimate);
+    rc->group_pixels = 0;
+    rc->group_hf = rc->group_hf_estimate = rc->group_lf = rc->group_lf_cost = 0.0f;
+}
+
+/*
+ * The quantization weights of channel c for a strategy larger than 8x8, and the largest
+ * coded one in *max_weight. These strategies are told apart by the number of blocks they cover.
+ */
+static const float *large_weights(const HYDEncoder *encoder, const uint8_t strategy, const int c,
+                                  float *max_weight) {
+    const size_t log2_covered = acs_log2_width[strategy] + acs_log2_height[strategy];
+    if (log2_covered == 1) {
+        *max_weight = encoder->hf_weight_max16x8[c];
+        return encoder->hf_weights16x8[c];
+    }
+    if (log2_covered == 2) {
+        *max_weight = encoder->hf_weight_max16[c];
+        return encoder->hf_weights16[c];
+    }
+    if (log2_covered == 3) {
+        *max_weight = encoder->hf_weight_max32x16[c];
+        return encoder->hf_weights32x16[c];
+    }
+    *max_weight = encoder->hf_weight_max32[c];
+    return encoder->hf_weights32[c];
+}
+
+/*
+ * Transform channel c of a varblock larger than 8x8 from the pixels at its top-left corner into
+ * coeffs, laid out like the output of HYDDCTQuantLargeKernel. A varblock wider than it is tall
+ * is transformed from its transpose, which puts its coefficients in the layout the decoder
+ * expects, but lists its LF values in column-major order. pred and recon are passed on to the kernel.
+ */
+static uint32_t dct_varblock(const HYDEncoder *encoder, XYBEntry *coeffs, const XYBEntry *pixels,
+                             const ptrdiff_t stride, const uint8_t strategy, const int c, const float mult,
+                             const float *pred, float *recon, size_t *last) {
+    XYBEntry transposed[512];
+    const size_t width = 8 << acs_log2_width[strategy];
+    const size_t height = 8 << acs_log2_height[strategy];
+    float max_weight;
+    const float *const weights = large_weights(encoder, strategy, c, &max_weight);
+    if (width <= height)
+        return encoder->dct_large_kernel(coeffs, pixels, stride, height, width, weights, max_weight, mult, pred,
+            recon, last);
+    for (size_t y = 0; y < height; y++) {
+        for (size_t x = 0; x < width; x++)
+            transposed[x * height + y] = pixels[y * stride + x];
+    }
+    return encoder->dct_large_kernel(coeffs, transposed, height, width, height, weights, max_weight, mult, pred,
+        recon, last);
+}
+
+/* 8x8 blocks that cost more than this are left alone, as larger transforms only win on smooth content */
+#define MERGE_MAX_BLOCK_COST 24.0f
+/* a merge has to be estimated to take less than this fraction of the bits of what it replaces */
+#define MERGE_MAX_RATIO 0.7f
+
+/*
+ * Estimate the luma cost of a varblock of the given strategy with its top-left block at (vx, y)
+ * of the strip, and pick its HfMul from the mean activity of its blocks.
+ */
+static float varblock_cost(const HYDEncoder *encoder, const XYBEntry *luma, const float *activity,
+                           const size_t vbw, const size_t vx, const size_t y, const uint8_t strategy,
+                           uint8_t *mult) {
+    XYBEntry scratch[1024];
+    size_t last;
+    const size_t width = 1 << acs_log2_width[strategy];
+    const size_t height = 1 << acs_log2_height[strategy];
+    float sum = 0.0f;
+    for (size_t dy = 0; dy < height; dy++) {
+        for (size_t dx = 0; dx < width; dx++)
+            sum += activity[(y + dy) * vbw + vx + dx];
+    }
+    *mult = adaptive_hf_mult(encoder, sum / (width * height));
+    dct_varblock(encoder, scratch, luma + y * 64 * vbw + (vx << 3), vbw << 3, strategy, 1, *mult, NULL, NULL,
+        &last);
+    /* one more for the non-zero count */
+    return coeff_cost(scratch, width * height, last + 1) + 1.0f;
+}
+
+/* Make the blocks at (vx, y) of the strip a single varblock of the given strategy. */
+static void set_varblock(uint8_t *strategy, uint8_t *hf_mult, const size_t vbw, const size_t vx, const size_t y,
+                         const uint8_t acs, const uint8_t mult) {
+    for (size_t dy = 0; dy < (size_t)1 << acs_log2_height[acs]; dy++)
+        memset(strategy + (y + dy) * vbw + vx, ACS_COVERED, (size_t)1 << acs_log2_width[acs]);
+    strategy[y * vbw + vx] = acs;
+    hf_mult[y * vbw + vx] = mult;
+}
+
+/*
+ * Merge the four quarters of the square region of 2^log2_side blocks with its top-left block
+ * at (vx, y) of the strip into the square transform over all of it, or failing that, pairs of
+ * quarters into the rectangular transform over both, in columns or in rows, whichever saves
+ * more. cost holds the cost of each quarter as 8x8 blocks, or a negative value if it cannot
+ * be merged.
+ */
+static void select_region(const HYDEncoder *encoder, const XYBEntry *luma, const float *activity,
+                           uint8_t *strategy, uint8_t *hf_mult, const size_t vbw, const size_t vx, const size_t y,
+                           const size_t log2_side, const float cost[2][2]) {
+    static const uint8_t squares[2] = {ACS_DCT16, ACS_DCT32};
+    static const uint8_t pairs[2][2] = {{ACS_DCT16X8, ACS_DCT8X16}, {ACS_DCT32X16, ACS_DCT16X32}};
+    const size_t half = (size_t)1 << (log2_side - 1);
+    const uint8_t square = squares[log2_side - 1];
+    const uint8_t *const pair = pairs[log2_side - 1];
+    uint8_t mult;
+    if (cost[0][0] >= 0.0f && cost[0][1] >= 0.0f && cost[1][0] >= 0.0f && cost[1][1] >= 0.0f) {
+        const float large = varblock_cost(encoder, luma, activity, vbw, vx, y, square, &mult);
+        if (large < MERGE_MAX_RATIO * (cost[0][0] + cost[0][1] + cost[1][0] + cost[1][1])) {
+            set_varblock(strategy, hf_mult, vbw, vx, y, square, mult);
+            return;
+        }
+    }
+    /* pairs in columns, then pairs in rows */
+    float saving[2] = {0.0f, 0.0f};
+    uint8_t merged[2][2] = {{0}}, pair_mult[2][2];
+    for (int o = 0; o < 2; o++) {
+        for (int i = 0; i < 2; i++) {
+            const float a = o ? cost[i][0] : cost[0][i];
+            const float b = o ? cost[i][1] : cost[1][i];
+            if (a < 0.0f || b < 0.0f)
+                continue;
+            const float large = varblock_cost(encoder, luma, activity, vbw, vx + (o ? 0 : i * half),
+                y + (o ? i * half : 0), pair[o], &pair_mult[o][i]);
+            if (large < MERGE_MAX_RATIO * (a + b)) {
+                merged[o][i] = 1;
+                saving[o] += a + b - large;
+            }
+        }
+    }
+    const int o = saving[1] > saving[0];
+    for (int i = 0; i < 2; i++) {
+        if (merged[o][i])
+            set_varblock(strategy, hf_mult, vbw, vx + (o ? 0 : i * half), y + (o ? i * half : 0),
+                pair[o], pair_mult[o][i]);
+    }
+}
+
+/*
+ * Choose the AC strategies of a strip of up to four block rows, starting at block row vy0,
+ * and the HfMul of each of its varblocks. Every aligned 32x32 region tries a DCT32, or else
+ * a pair of DCT32X16 or DCT16X32 halves, and every aligned 16x16 region left over then tries
+ * a DCT16, or else DCT16X8 or DCT8X16 pairs, estimated on the luma alone. Smooth content wins
+ * outright, while on texture the large transforms ring and spread the energy over more
+ * coefficients, so regions with costly blocks are not even tried.
+ * activity and cost each hold 4 rows of lf_varblock_width.
+ */
+static void select_ac_strategies(const HYDEncoder *encoder, const HYDLFGroup *lf_group, float *activity,
+                                 float *cost, uint8_t *ac_strategy, uint8_t *hf_mult, const size_t vy0,
+                                 const size_t strip_h) {
+    XYBEntry scratch[64];
+    size_t last;
+    const size_t vbw = lf_group->lf_varblock_width;
+    const size_t lf_pad_w = vbw << 3;
+    const XYBEntry *const luma = encoder->xyb[1] + vy0 * 8 * lf_pad_w;
+    uint8_t *const strategy = ac_strategy + vy0 * vbw;
+    uint8_t *const mult = hf_mult + vy0 * vbw;
+
+    for (size_t y = 0; y < strip_h; y++) {
+        for (size_t vx = 0; vx < vbw; vx++) {
+            const size_t pos = y * vbw + vx;
+            const XYBEntry *const block = luma + y * 8 * lf_pad_w + (vx << 3);
+            activity[pos] = block_activity(block, lf_pad_w);
+            strategy[pos] = ACS_DCT8;
+            mult[pos] = adaptive_hf_mult(encoder, activity[pos]);
+            encoder->dct_kernel(scratch, block, lf_pad_w, encoder->hf_weights[1], encoder->hf_weight_max[1],
+                mult[pos], NULL, NULL, &last);
+            /* one more for the non-zero count */
+            cost[pos] = coeff_cost(scratch, 1, last + 1) + 1.0f;
+        }
+    }
+
+    /* 32x32 regions first, then the 16x16 regions they left over */
+    for (size_t log2_side = 2; log2_side > 0; log2_side--) {
+        const size_t half = (size_t)1 << (log2_side - 1);
+        for (size_t y = 0; y < strip_h; y += 2 * half) {
+            for (size_t vx = 0; vx < vbw; vx += 2 * half) {
+                float quarters[2][2];
+                for (size_t q = 0; q < 4; q++) {
+                    const size_t qy = y + (q >> 1) * half;
+                    const size_t qx = vx + (q & 1) * half;
+                    float sum = -1.0f;
+                    if (qy + half <= strip_h && qx + half <= vbw) {
+                        sum = 0.0f;
+                        for (size_t dy = 0; dy < half && sum >= 0.0f; dy++) {
+                            for (size_t dx = 0; dx < half; dx++) {
+                                const size_t pos = (qy + dy) * vbw + qx + dx;
+                                if (strategy[pos] != ACS_DCT8 || cost[pos] > MERGE_MAX_BLOCK_COST) {
+                                    sum = -1.0f;
+                                    break;
+                                }
+                                sum += cost[pos];
+                            }
+                        }
+                    }
+                    quarters[q >> 1][q & 1] = sum;
+                }
+                select_region(encoder, luma, activity, strategy, mult, vbw, vx, y, log2_side, quarters);
+            }
+        }
+    }
+}
+
+/*
+ * Transform a varblock larger than 8x8 with its top-left block at (vx, vy) and spread its
+ * coefficients over the slots of the blocks it covers, 64 apiece in natural order. Each slot
+ * still has to lead with the LF value of its own block, so for every covered block j after
+ * the first, natural index 64 j trades places with index j, which is never coded.
+ * pred and recon are in the order of the kernel output, before that exchange.
+ */
+static uint32_t transform_varblock(HYDEncoder *encoder, const HYDLFGroup *lf_group, const int c,
+                                   const size_t vx, const size_t vy, const XYBEntry *pixels,
+                                   const uint8_t strategy, const float mult, const float *pred, float *recon,
+                                   size_t *last) {
+    XYBEntry large[1024];
+    const size_t vbw = lf_group->lf_varblock_width;
+    const size_t log2_width = acs_log2_width[strategy];
+    const size_t log2_height = acs_log2_height[strategy];
+    const uint32_t nz = dct_varblock(encoder, large, pixels, vbw << 3, strategy, c, mult, pred, recon, last);
+    XYBEntry *const first = encoder->xyb[c] + ((vy * vbw + vx) << 6);
+    for (size_t j = 0; j < (size_t)1 << (log2_width + log2_height); j++) {
+        const size_t dy = j >> log2_width;
+        const size_t dx = j & ((1 << log2_width) - 1);
+        XYBEntry *slot = encoder->xyb[c] + (((vy + dy) * vbw + vx + dx) << 6);
+        memcpy(slot, large + (j << 6), 64 * sizeof(XYBEntry));
+        if (j) {
+            slot[0] = large[log2_width > log2_height ? (dx << log2_height) + dy : j];
+            first[j] = large[j << 6];
+        }
+    }
+    return nz;
+}
+
+/*
+ * Fit the X and B chroma-from-luma factors of every 64x64 tile of the LF group, by least squares
+ * of the chroma against the luma with the mean of each 8x8 block removed. That is the fit over
+ * the AC coefficients of the blocks, whose sums of products only differ by a common scale.
+ * The B plane already has the luma subtracted, so its factor is relative to the default of one.
+ * cfl holds the XFromY factors in raster order, followed by the BFromY factors, in units of 1/84.
+ */
+static void fit_cfl_factors(const HYDEncoder *encoder, const HYDLFGroup *lf_group, int8_t *cfl) {
+    const size_t vbw = lf_group->lf_varblock_width;
+    const size_t vbh = lf_group->lf_varblock_height;
+    const size_t lf_pad_w = vbw << 3;
+    const size_t cfl_w = (vbw + 7) >> 3;
+    const size_t cfl_h = (vbh + 7) >> 3;
+    for (size_t ty = 0; ty < cfl_h; ty++) {
+        for (size_t tx = 0; tx < cfl_w; tx++) {
+            float xy = 0.0f, by = 0.0f, yy = 0.0f;
+            for (size_t vy = ty << 3; vy < hyd_min((ty + 1) << 3, vbh); vy++) {
+                for (size_t vx = tx << 3; vx < hyd_min((tx + 1) << 3, vbw); vx++) {
+                    const size_t start = vy * 8 * lf_pad_w + (vx << 3);
+                    float sx = 0.0f, sy = 0.0f, sb = 0.0f, sxy = 0.0f, sby = 0.0f, syy = 0.0f;
+                    for (size_t y = 0; y < 8; y++) {
+                        for (size_t x = 0; x < 8; x++) {
+                            const size_t p = start + y * lf_pad_w + x;
+                            const float xv = encoder->xyb[0][p].f;
+                            const float yv = encoder->xyb[1][p].f;
+                            const float bv = encoder->xyb[2][p].f;
+                            sx += xv;
+                            sy += yv;
+                            sb += bv;
+                            sxy += xv * yv;
+                            sby += bv * yv;
+                            syy += yv * yv;
+                        }
+                    }
+                    xy += sxy - sx * sy * 0.015625f;
+                    by += sby - sb * sy * 0.015625f;
+                    yy += syy - sy * sy * 0.015625f;
+                }
+            }
+            /* a flat tile has nothing to predict from */
+            const float kx = yy > 1e-6f ? 84.0f * xy / yy : 0.0f;
+            const float kb = yy > 1e-6f ? 84.0f * by / yy : 0.0f;
+            cfl[ty * cfl_w + tx] = (int8_t)hyd_clamp(kx + (kx < 0.0f ? -0.5f : 0.5f), -128.0f, 127.0f);
+            cfl[(cfl_h + ty) * cfl_w + tx] = (int8_t)hyd_clamp(kb + (kb < 0.0f ? -0.5f : 0.5f), -128.0f, 127.0f);
+        }
+    }
+}
+
 static HYDStatusCode send_tile_pre(HYDEncoder *encoder, uint32_t tile_x, uint32_t tile_y, int is_last) {
     HYDStatusCode ret;
 
@@ -382,6 +1159,7 @@ static HYDStatusCode send_tile_pre(HYDEncoder *encoder, uint32_t tile_x, uint32_
     if (encoder->writer.overflow_state)
         return encoder->writer.overflow_state;
 
+    const size_t header_start = working_bits(&encoder->writer);
     if (!encoder->wrote_header) {
         ret = write_header(encoder);
         if (ret < HYD_ERROR_START)
@@ -393,12 +1171,19 @@ static HYDStatusCode send_tile_pre(HYDEncoder *encoder, uint32_t tile_x, uint32_
         if (ret < HYD_ERROR_START)
             return ret;
     }
+    if (encoder->rc.budget)
+        rate_control_overhead(encoder, working_bits(&encoder->writer) - header_start);
 
-    size_t xyb_pixels = lf_group->lf_varblock_height * lf_group->lf_varblock_width * 64;
-    XYBEntry *temp_xyb = hyd_reallocarray(&encoder->allocator, encoder->xyb, 3 * xyb_pixels, sizeof(XYBEntry));
+    /* one plane per channel, each starting on a 64-byte boundary */
+    const size_t xyb_pixels = lf_group->lf_varblock_height * lf_group->lf_varblock_width * 64;
+    XYBEntry *temp_xyb = hyd_reallocarray(&encoder->allocator, encoder->xyb_buffer, 3 * xyb_pixels + 16,
+        sizeof(XYBEntry));
     if (!temp_xyb)
         return HYD_NOMEM;
-    encoder->xyb = temp_xyb;
+    encoder->xyb_buffer = temp_xyb;
+    temp_xyb += ((64 - ((uintptr_t)temp_xyb & 63)) & 63) / sizeof(XYBEntry);
+    for (int c = 0; c < 3; c++)
+        encoder->xyb[c] = temp_xyb + c * xyb_pixels;
 
     return HYD_OK;
 }
@@ -409,10 +1194,9 @@ static HYDStatusCode write_lf_global(HYDEncoder *encoder) {
     // LF channel quantization all_default
     hyd_write_bool(bw, 1);
 
-    // quantizer globalScale = 32768
-    hyd_write_u32(bw, &global_scale_table, 32768);
-    // quantizer quantLF = 4
-    hyd_write_u32(bw, &quant_lf_table, 4);
+    // quantizer globalScale and quantLF
+    hyd_write_u32(bw, &global_scale_table, encoder->global_scale);
+    hyd_write_u32(bw, &quant_lf_table, encoder->quant_lf);
     // HF Block Context all_default
     hyd_write_bool(bw, 1);
     // LF Channel Correlation
@@ -421,7 +1205,15 @@ static HYDStatusCode write_lf_global(HYDEncoder *encoder) {
     return hyd_write_bool(bw, 0);
 }
 
-static HYDStatusCode write_lf_group(HYDEncoder *encoder, HYDLFGroup *lf_group) {
+/* the configured LZ77 window, or else one that covers all num_symbols symbols of a stream */
+static uint32_t get_lz77_window(const HYDEncoder *encoder, size_t num_symbols) {
+    if (encoder->metadata.lz77_window)
+        return encoder->metadata.lz77_window;
+    return hyd_clamp(num_symbols, 1, 1 << 20);
+}
+
+static HYDStatusCode write_lf_group(HYDEncoder *encoder, HYDLFGroup *lf_group, const int8_t *cfl,
+                                    const uint8_t *ac_strategy, const uint8_t *hf_mult) {
     HYDStatusCode ret;
     HYDBitWriter *bw = &encoder->working_writer;
     // extra precision = 0
@@ -452,24 +1244,24 @@ static HYDStatusCode write_lf_group(HYDEncoder *encoder, HYDLFGroup *lf_group) {
     size_t nb_blocks = lf_group->lf_varblock_width * lf_group->lf_varblock_height;
     ret = hyd_entropy_init_stream(&stream, &encoder->allocator, bw, 3 * nb_blocks, zerobuf,
                                   1, 1, 1 << 14, 1, &encoder->error);
+    if (ret < HYD_ERROR_START)
+        return ret;
+    ret = hyd_entropy_set_lz77_window(&stream, get_lz77_window(encoder, 3 * nb_blocks));
     if (ret < HYD_ERROR_START)
         return ret;
     ret = hyd_entropy_set_hybrid_config(&stream, 0, 0, 7, 1, 1);
     if (ret < HYD_ERROR_START)
         return ret;
-    const float shift[3] = {8192.f, 1024.f, 512.f};
     for (int i = 0; i < 3; i++) {
         const int c = i < 2 ? 1 - i : i;
         for (size_t vy = 0; vy < lf_group->lf_varblock_height; vy++) {
-            const size_t y = vy << 3;
-            const size_t row = lf_group->stride * y;
             for (size_t vx = 0; vx < lf_group->lf_varblock_width; vx++) {
-                const size_t x = vx << 3;
-                XYBEntry *xyb = encoder->xyb + ((row + x) * 3 + c);
-                xyb->i = (int32_t)(xyb->f * shift[c]);
-                const int32_t w = x > 0 ? (xyb - 24)->i : y > 0 ? (xyb - 24 * lf_group->stride)->i : 0;
-                const int32_t n = y > 0 ? (xyb - 24 * lf_group->stride)->i : w;
-                const int32_t nw = x > 0 && y > 0 ? (xyb - 24 * (lf_group->stride + 1))->i : w;
+                /* the DC coefficient leads each block */
+                XYBEntry *xyb = encoder->xyb[c] + ((vy * lf_group->lf_varblock_width + vx) << 6);
+                xyb->i = (int32_t)(xyb->f * encoder->lf_scale[c]);
+                const int32_t w = vx > 0 ? (xyb - 64)->i : vy > 0 ? (xyb - 8 * lf_group->stride)->i : 0;
+                const int32_t n = vy > 0 ? (xyb - 8 * lf_group->stride)->i : w;
+                const int32_t nw = vx > 0 && vy > 0 ? (xyb - 8 * lf_group->stride - 64)->i : w;
                 const int32_t vp = w + n - nw;
                 const int32_t min = hyd_min(w, n);
                 const int32_t max = hyd_max(w, n);
@@ -480,79 +1272,54 @@ static HYDStatusCode write_lf_group(HYDEncoder *encoder, HYDLFGroup *lf_group) {
     }
     if ((ret = hyd_prefix_finalize_stream(&stream)) < HYD_ERROR_START)
         return ret;
-    hyd_write(bw, nb_blocks - 1, hyd_cllog2(nb_blocks));
+    /* BlockInfo holds one column per varblock, at their top-left blocks in raster order */
+    size_t nb_varblocks = 0;
+    for (size_t i = 0; i < nb_blocks; i++)
+        nb_varblocks += ac_strategy[i] != ACS_COVERED;
+    hyd_write(bw, nb_varblocks - 1, hyd_cllog2(nb_blocks));
     hyd_write(bw, 0x2, 4);
-    ret = hyd_entropy_init_stream(&stream, &encoder->allocator, bw, 5, zerobuf,
+    ret = hyd_entropy_init_stream(&stream, &encoder->allocator, bw, hyd_array_size(hf_meta_ma_tree), zerobuf,
                                   6, 0, 0, 0, &encoder->error);
     if (ret < HYD_ERROR_START)
         return ret;
-    hyd_entropy_send_symbol(&stream, 1, 0);
-    hyd_entropy_send_symbol(&stream, 2, 0);
-    hyd_entropy_send_symbol(&stream, 3, 0);
-    hyd_entropy_send_symbol(&stream, 4, 0);
-    hyd_entropy_send_symbol(&stream, 5, 0);
+    for (size_t i = 0; i < hyd_array_size(hf_meta_ma_tree); i++) {
+        ret = hyd_entropy_send_symbol(&stream, hf_meta_ma_tree[i][0], hf_meta_ma_tree[i][1]);
+        if (ret < HYD_ERROR_START)
+            return ret;
+    }
     if ((ret = hyd_prefix_finalize_stream(&stream)) < HYD_ERROR_START)
         return ret;
     size_t cfl_width = (lf_group->lf_varblock_width + 7) >> 3;
     size_t cfl_height = (lf_group->lf_varblock_height + 7) >> 3;
-    size_t num_z_pre = 2 * cfl_width * cfl_height + nb_blocks;
-    size_t num_sym = num_z_pre + 2 * nb_blocks;
-    ret = hyd_entropy_init_stream(&stream, &encoder->allocator, bw, num_sym, zerobuf,
-        1, 0, 29, 1, &encoder->error);
+    size_t num_z_pre = 2 * cfl_width * cfl_height;
+    size_t num_sym = num_z_pre + 2 * nb_varblocks + nb_blocks;
+    /* the LZ77 tokens start above the largest HfMul token */
+    ret = hyd_entropy_init_stream(&stream, &encoder->allocator, bw, num_sym, hf_meta_cluster_map,
+        4, 0, 40, 1, &encoder->error);
+    if (ret < HYD_ERROR_START)
+        return ret;
+    ret = hyd_entropy_set_lz77_window(&stream, get_lz77_window(encoder, num_sym));
     if (ret < HYD_ERROR_START)
         return ret;
     for (size_t i = 0; i < num_z_pre; i++)
-        hyd_entropy_send_symbol(&stream, 0, 0);
-    for (size_t i = 0; i < nb_blocks; i++)
-        hyd_entropy_send_symbol(&stream, 0, (hf_mult - 1) * 2);
+        hyd_entropy_send_symbol(&stream, 0, hyd_pack_signed(cfl[i]));
+    for (size_t i = 0; i < nb_blocks; i++) {
+        if (ac_strategy[i] != ACS_COVERED)
+            hyd_entropy_send_symbol(&stream, 3, ac_strategy[i] * 2);
+    }
+    for (size_t i = 0; i < nb_blocks; i++) {
+        if (ac_strategy[i] != ACS_COVERED)
+            hyd_entropy_send_symbol(&stream, 2, (hf_mult[i] - 1) * 2);
+    }
     for (size_t i = 0; i < nb_blocks; i++)
-        hyd_entropy_send_symbol(&stream, 0, 0);
+        hyd_entropy_send_symbol(&stream, 1, 0);
     if ((ret = hyd_prefix_finalize_stream(&stream)) < HYD_ERROR_START)
         return ret;
 
     return bw->overflow_state;
 }
 
-static void forward_dct(HYDEncoder *encoder, HYDLFGroup *lf_group) {
-    float scratchblock[2][8][8];
-    for (size_t c = 0; c < 3; c++) {
-        for (size_t by = 0; by < lf_group->lf_varblock_height; by++) {
-            size_t vy = by << 3;
-            for (size_t bx = 0; bx < lf_group->lf_varblock_width; bx++) {
-                memset(scratchblock, 0, sizeof(scratchblock));
-                size_t vx = bx << 3;
-                for (size_t y = 0; y < 8; y++) {
-                    const size_t posy = (vy + y) * lf_group->stride + vx;
-                    scratchblock[0][y][0] = encoder->xyb[posy * 3 + c].f;
-                    for (size_t x = 1; x < 8; x++)
-                        scratchblock[0][y][0] += encoder->xyb[(posy + x) * 3 + c].f;
-                    scratchblock[0][y][0] *= 0.125f;
-                    for (size_t k = 1; k < 8; k++) {
-                        for (size_t n = 0; n < 8; n++)
-                            scratchblock[0][y][k] += encoder->xyb[(posy + n) * 3 + c].f * cosine_lut[k - 1][n];
-                    }
-                }
-                for (size_t x = 0; x < 8; x++) {
-                    scratchblock[1][0][x] = scratchblock[0][0][x];
-                    for (size_t y = 1; y < 8; y++)
-                        scratchblock[1][0][x] += scratchblock[0][y][x];
-                    scratchblock[1][0][x] *= 0.125f;
-                    for (size_t k = 1; k < 8; k++) {
-                        for (size_t n = 0; n < 8; n++)
-                            scratchblock[1][k][x] += scratchblock[0][n][x] * cosine_lut[k - 1][n];
-                    }
-                }
-                for (size_t y = 0; y < 8; y++) {
-                    size_t posy = (vy + y) * lf_group->stride + vx;
-                    for (size_t x = 0; x < 8; x++)
-                        encoder->xyb[(posy + x) * 3 + c].f = scratchblock[1][x][y];
-                }
-            }
-        }
-    }
-}
-
-static uint8_t get_predicted_non_zeroes(uint8_t *nz, size_t y, size_t x, size_t w, int c) {
+static uint16_t get_predicted_non_zeroes(const uint16_t *nz, size_t y, size_t x, size_t w, int c) {
     if (!x && !y)
         return 32;
     if (!x)
@@ -562,6 +1329,9 @@ static uint8_t get_predicted_non_zeroes(uint8_t *nz, size_t y, size_t x, size_t
     return (nz[((y - 1) * w + x) * 3 + c] + (uint32_t)nz[((y * w) + (x - 1)) * 3 + c] + 1) >> 1;
 }
 
+/* the non-zero count contexts come first, so HF LZ77 copies start on block boundaries */
+#define HF_LZ77_START_DISTS 555
+
 static size_t get_non_zero_context(size_t predicted, size_t block_context) {
     if (predicted < 8)
         return block_context + 15 * predicted;
@@ -572,8 +1342,8 @@ static size_t get_non_zero_context(size_t predicted, size_t block_context) {
 }
 
 static HYDStatusCode initialize_hf_coeffs(HYDEncoder *encoder, HYDEntropyStream *stream, HYDLFGroup *lf_group,
-                                          size_t num_non_zeroes, size_t *symbol_count, uint8_t *non_zeroes,
-                                          size_t gindex) {
+                                          size_t num_non_zeroes, const uint8_t *ac_strategy,
+                                          size_t *symbol_count, uint16_t *non_zeroes, size_t gindex) {
     HYDStatusCode ret;
     for (size_t gy = 0; gy < lf_group->tile_count_y; gy++) {
         if (gy << 8 >= lf_group->lf_group_height)
@@ -587,42 +1357,59 @@ static HYDStatusCode initialize_hf_coeffs(HYDEncoder *encoder, HYDEntropyStream
             const size_t gw = (gx + 1) << 8 > lf_group->lf_group_width ?
                 lf_group->lf_group_width - (gx << 8) : 256;
             const size_t gbw = (gw + 7) >> 3;
+            const size_t group_start = stream->symbol_pos;
             for (size_t by = 0; by < gbh; by++) {
-                const size_t vy = (by << 3) + (gy << 8);
+                const size_t vy = (gy << 5) + by;
                 for (size_t bx = 0; bx < gbw; bx++) {
-                    const size_t vx = (bx << 3) + (gx << 8);
+                    const size_t vx = (gx << 5) + bx;
+                    const uint8_t strategy = ac_strategy[vy * lf_group->lf_varblock_width + vx];
+                    if (strategy == ACS_COVERED)
+                        continue;
+                    const size_t log2_width = acs_log2_width[strategy];
+                    const size_t log2_covered = log2_width + acs_log2_height[strategy];
+                    const size_t covered = 1 << log2_covered;
                     for (int i = 0; i < 3; i++) {
                         int c = i < 2 ? 1 - i : i;
-                        uint8_t predicted = get_predicted_non_zeroes(non_zeroes, by, bx, gbw, c);
-                        size_t block_context = hf_block_cluster_map[13 * i];
+                        uint16_t predicted = get_predicted_non_zeroes(non_zeroes, by, bx, gbw, c);
+                        size_t block_context = hf_block_cluster_map[13 * i + acs_order[strategy]];
                         size_t non_zero_context = get_non_zero_context(predicted, block_context);
                         uint32_t non_zero_count = non_zeroes[(by * gbw + bx) * 3 + c];
                         ret = hyd_entropy_send_symbol(stream, non_zero_context, non_zero_count);
-                        symbol_count[gindex]++;
                         if (ret < HYD_ERROR_START)
                             return ret;
+                        /* from here on, predictions see the per-block count like the rest of the varblock */
+                        non_zeroes[(by * gbw + bx) * 3 + c] = (non_zero_count + covered - 1) >> log2_covered;
                         if (!non_zero_count)
                             continue;
                         size_t hist_context = 458 * block_context + 555;
-                        for (int k = 0; k < 63; k++) {
-                            IntPos pos = natural_order[k + 1];
-                            IntPos prev_pos = natural_order[k];
-                            const size_t prev_pos_s = (vy + prev_pos.y) * lf_group->stride + (vx + prev_pos.x);
-                            const size_t pos_s = (vy + pos.y) * lf_group->stride + (vx + pos.x);
-                            int prev = k ? !!encoder->xyb[prev_pos_s * 3 + c].i : non_zero_count <= 4;
+                        const XYBEntry *coeffs = encoder->xyb[c] +
+                            ((vy * lf_group->lf_varblock_width + vx) << 6);
+                        int prev = non_zero_count <= (uint32_t)4 << log2_covered;
+                        for (size_t k = covered; k < (size_t)64 << log2_covered; k++) {
                             size_t coeff_context = hist_context + prev +
-                                ((coeff_num_non_zero_context[non_zero_count] + coeff_freq_context[k + 1]) << 1);
-                            uint32_t value = hyd_pack_signed(encoder->xyb[pos_s * 3 + c].i);
+                                ((coeff_num_non_zero_context[(non_zero_count + covered - 1) >> log2_covered] +
+                                coeff_freq_context[k >> log2_covered]) << 1);
+                            /* see transform_varblock for where the coefficients of a varblock live */
+                            const size_t pos = k & 63 ? k : k >> 6;
+                            const XYBEntry *coeff = pos < 64 ? coeffs + pos : coeffs +
+                                ((((pos >> (6 + log2_width)) * lf_group->lf_varblock_width) +
+                                ((pos >> 6) & ((1 << log2_width) - 1))) << 6) + (pos & 63);
+                            uint32_t value = hyd_pack_signed(coeff->i);
                             ret = hyd_entropy_send_symbol(stream, coeff_context, value);
-                            symbol_count[gindex]++;
                             if (ret < HYD_ERROR_START)
                                 return ret;
                             if (value && !--non_zero_count)
                                 break;
+                            prev = !!value;
                         }
                     }
                 }
             }
+            /* each group is decoded on its own, so LZ77 copies stay within it */
+            ret = hyd_entropy_flush_lz77(stream);
+            if (ret < HYD_ERROR_START)
+                return ret;
+            symbol_count[gindex] = stream->symbol_pos - group_start;
             non_zeroes += 3 << 10;
             gindex++;
         }
@@ -643,7 +1430,14 @@ static HYDStatusCode realloc_working_buffer(HYDAllocator *allocator, uint8_t **b
 }
 
 static HYDStatusCode encode_xyb_buffer(HYDEncoder *encoder, size_t tile_x, size_t tile_y) {
-    uint8_t *non_zeroes = NULL;
+    uint16_t *non_zeroes = NULL;
+    uint8_t *ac_strategy = NULL;
+    uint8_t *hf_mult = NULL;
+    float *activity = NULL;
+    float *cost = NULL;
+    int8_t *cfl = NULL;
+    float *rc_cost = NULL;
+    XYBEntry *block_strip = NULL;
     HYDStatusCode ret = HYD_OK;
     int need_buffer_init = !encoder->working_writer.buffer || !encoder->one_frame;
     if (!encoder->working_writer.buffer) {
@@ -667,59 +1461,118 @@ static HYDStatusCode encode_xyb_buffer(HYDEncoder *encoder, size_t tile_x, size_
 
     const size_t lfid = encoder->one_frame ? tile_y * encoder->lf_group_count_x + tile_x : 0;
     HYDLFGroup *lf_group = &encoder->lf_group[lfid];
-    forward_dct(encoder, lf_group);
     size_t frame_w = encoder->one_frame ? encoder->metadata.width : encoder->lf_group->lf_group_width;
     size_t frame_h = encoder->one_frame ? encoder->metadata.height : encoder->lf_group->lf_group_height;
     size_t frame_groups_y = ((frame_h + 255) >> 8);
     size_t frame_groups_x = ((frame_w + 255) >> 8);
     size_t num_frame_groups = frame_groups_x * frame_groups_y;
     const size_t num_groups = ((lf_group->lf_group_width + 255) >> 8) * ((lf_group->lf_group_height + 255) >> 8);
-    non_zeroes = hyd_calloc(&encoder->allocator, 3072, num_groups);
+    non_zeroes = hyd_calloc(&encoder->allocator, 3072 * num_groups, sizeof(uint16_t));
     if (!non_zeroes) {
         ret = HYD_NOMEM;
         goto end;
     }
 
+    /*
+     * The coefficients are stored block-major, in natural order, in place of the pixels.
+     * A strip of four block rows spans exactly its own 32 pixel rows, so it is transformed
+     * from a copy, which also holds the pixels of every varblock that starts in it.
+     * The decoder predicts the chroma HF coefficients from the dequantized luma ones,
+     * so the luma of each varblock goes first.
+     */
+    static const int channel_order[3] = {1, 0, 2};
+    const size_t vbw = lf_group->lf_varblock_width;
+    const size_t vbh = lf_group->lf_varblock_height;
+    const size_t lf_pad_w = vbw << 3;
+    const size_t cfl_w = (vbw + 7) >> 3;
+    const size_t cfl_h = (vbh + 7) >> 3;
+    block_strip = hyd_mallocarray(&encoder->allocator, 96 * lf_pad_w, sizeof(XYBEntry));
+    activity = hyd_mallocarray(&encoder->allocator, 4 * vbw, sizeof(float));
+    cost = hyd_mallocarray(&encoder->allocator, 4 * vbw, sizeof(float));
+    ac_strategy = hyd_mallocarray(&encoder->allocator, vbh, vbw);
+    hf_mult = hyd_mallocarray(&encoder->allocator, vbh, vbw);
+    cfl = hyd_mallocarray(&encoder->allocator, 2 * cfl_h, cfl_w);
+    if (!block_strip || !activity || !cost || !ac_strategy || !hf_mult || !cfl) {
+        ret = HYD_NOMEM;
+        goto end;
+    }
+    fit_cfl_factors(encoder, lf_group, cfl);
+    /* the sampled HF costs of the strips, followed by their LF costs */
+    const size_t strips = (vbh + 3) >> 2;
+    if (encoder->rc.budget) {
+        rc_cost = hyd_mallocarray(&encoder->allocator, 2 * strips, sizeof(float));
+        if (!rc_cost) {
+            ret = HYD_NOMEM;
+            goto end;
+        }
+        rate_control_begin_group(encoder, lf_group, rc_cost, rc_cost + strips);
+    }
+
     size_t non_zero_count = 0;
-    size_t gindex = 0;
-    const size_t lf_pad_w = lf_group->lf_varblock_width << 3;
-    for (size_t gy = 0; gy < lf_group->tile_count_y; gy++) {
-        if (gy << 5 >= lf_group->lf_varblock_height)
-            break;
-        const size_t gh = ((gy + 1) << 8) > lf_group->lf_group_height ?
-            lf_group->lf_group_height - (gy << 8) : 256;
-        const size_t gbh = (gh + 7) >> 3;
-        for (size_t gx = 0; gx < lf_group->tile_count_x; gx++) {
-            if (gx << 5 >= lf_group->lf_varblock_width)
-                break;
-            const size_t gw = (gx + 1) << 8 > lf_group->lf_group_width ?
-                lf_group->lf_group_width - (gx << 8) : 256;
-            const size_t gbw = (gw + 7) >> 3;
-            for (size_t by = 0; by < gbh; by++) {
-                const size_t vy = (by << 3) + (gy << 8);
-                for (size_t bx = 0; bx < gbw; bx++) {
-                    const size_t vx = (bx << 3) + (gx << 8);
-                    for (int i = 0; i < 3; i++) {
-                        size_t nzc = 0;
-                        for (int j = 1; j < 64; j++) {
-                            const size_t py = vy + natural_order[j].y;
-                            const size_t px = vx + natural_order[j].x;
-                            XYBEntry *xyb = encoder->xyb + ((py * lf_pad_w + px) * 3 + i);
-                            const int32_t q = (int32_t)(xyb->f * hf_quant_weights[i][j] * (float)hf_mult);
-                            xyb->i = hyd_abs(q) < 2 ? 0 : q;
-                            if (xyb->i) {
-                                non_zeroes[((gindex << 10) + by * gbw + bx) * 3 + i]++;
-                                nzc = j;
+    const size_t groups_x = (vbw + 31) >> 5;
+    for (size_t vy0 = 0; vy0 < vbh; vy0 += 4) {
+        const size_t strip_h = hyd_min(vbh - vy0, 4);
+        /* the luma of this strip is still untransformed */
+        select_ac_strategies(encoder, lf_group, activity, cost, ac_strategy, hf_mult, vy0, strip_h);
+        float rc_estimate = 0.0f;
+        if (encoder->rc.budget)
+            rate_control_strip(encoder, lf_group, rc_cost, rc_cost + strips, cost, ac_strategy + vy0 * vbw,
+                hf_mult + vy0 * vbw, vy0 >> 2, strip_h * vbw);
+        for (int i = 0; i < 3; i++)
+            memcpy(block_strip + i * 32 * lf_pad_w, encoder->xyb[i] + vy0 * 8 * lf_pad_w,
+                8 * strip_h * lf_pad_w * sizeof(XYBEntry));
+        for (size_t vy = vy0; vy < vy0 + strip_h; vy++) {
+            const size_t by = vy & 31;
+            for (size_t vx = 0; vx < vbw; vx++) {
+                const uint8_t strategy = ac_strategy[vy * vbw + vx];
+                if (strategy == ACS_COVERED)
+                    continue;
+                const size_t log2_covered = acs_log2_width[strategy] + acs_log2_height[strategy];
+                const size_t gx = vx >> 5;
+                const size_t gbw = hyd_min(vbw - (gx << 5), 32);
+                const size_t gindex = (vy >> 5) * groups_x + gx;
+                uint16_t *const nz = non_zeroes + ((gindex << 10) + by * gbw + (vx & 31)) * 3;
+                float luma[1024], prediction[1024];
+                for (int j = 0; j < 3; j++) {
+                    const int i = channel_order[j];
+                    const XYBEntry *const pixels = block_strip + (i * 32 + (vy - vy0) * 8) * lf_pad_w + (vx << 3);
+                    /* the decoder adds the factor times the dequantized luma to every HF coefficient */
+                    const float k = i != 1 && nz[1] ?
+                        cfl[((i >> 1) * cfl_h + (vy >> 3)) * cfl_w + (vx >> 3)] * (1.0f / 84.0f) : 0.0f;
+                    const float *const pred = k != 0.0f ? prediction : NULL;
+                    for (size_t p = 0; pred && p < (size_t)64 << log2_covered; p++)
+                        prediction[p] = k * luma[p];
+                    float *const recon = i == 1 ? luma : NULL;
+                    size_t nzc;
+                    if (strategy == ACS_DCT8) {
+                        nz[i] = encoder->dct_kernel(encoder->xyb[i] + ((vy * vbw + vx) << 6), pixels, lf_pad_w,
+                            encoder->hf_weights[i], encoder->hf_weight_max[i], hf_mult[vy * vbw + vx], pred, recon,
+                            &nzc);
+                    } else {
+                        nz[i] = transform_varblock(encoder, lf_group, i, vx, vy, pixels, strategy,
+                            hf_mult[vy * vbw + vx], pred, recon, &nzc);
+                        /* the other blocks only feed the predictions of their neighbors */
+                        const uint16_t per_block = (nz[i] + (1 << log2_covered) - 1) >> log2_covered;
+                        for (size_t dy = 0; dy < (size_t)1 << acs_log2_height[strategy]; dy++) {
+                            for (size_t dx = 0; dx < (size_t)1 << acs_log2_width[strategy]; dx++) {
+                                if (dy || dx)
+                                    nz[(dy * gbw + dx) * 3 + i] = per_block;
                             }
                         }
-                        non_zero_count += nzc;
                     }
+                    non_zero_count += nzc;
+                    if (encoder->rc.budget)
+                        rc_estimate += estimate_varblock_bits(encoder, lf_group, i, vx, vy, strategy, nz[i], nzc);
                 }
             }
-            gindex++;
         }
+        if (encoder->rc.budget)
+            rate_control_account(encoder, rc_cost[strips + (vy0 >> 2)],
+                hyd_min(lf_group->lf_group_height - 8 * vy0, 32) * lf_group->lf_group_width, rc_estimate);
     }
 
+    const size_t lf_start = working_bits(&encoder->working_writer);
+
     if (!encoder->tiles_sent) {
         if (num_frame_groups > 1) {
             encoder->section_endpos = hyd_calloc(&encoder->allocator, 2 + encoder->lf_groups_per_frame +
@@ -738,25 +1591,71 @@ static HYDStatusCode encode_xyb_buffer(HYDEncoder *encoder, size_t tile_x, size_
         }
     }
 
-    ret = write_lf_group(encoder, lf_group);
+    ret = write_lf_group(encoder, lf_group, cfl, ac_strategy, hf_mult);
     if (ret < HYD_ERROR_START)
         goto end;
+    const size_t lf_bits = working_bits(&encoder->working_writer) - lf_start;
 
     if (num_frame_groups > 1) {
         hyd_bitwriter_flush(&encoder->working_writer);
         encoder->section_endpos[encoder->section_count++] = encoder->working_writer.buffer_pos;
     }
 
+    /*
+     * prefix codes are built from the counted histograms, so they take precedence over fixed ones,
+     * and a frame of a single group has nothing to code ahead, so it keeps the smaller counted ones
+     */
+    const int fixed_histograms = encoder->one_frame && encoder->metadata.fixed_histograms
+        && !encoder->metadata.prefix_codes && num_frame_groups > 1;
+    /* the HF global section comes after every LF group, but the fixed histograms are known already */
+    const int code_ahead = fixed_histograms;
     if (!encoder->tiles_sent) {
         const size_t num_syms = 1 << 12;
+        /*
+         * the LZ77 tokens start above the largest coefficient token, 16 + 2 * (31 - 4) + 1,
+         * and end within the 256 symbols of ANS, but the fixed histograms have no room for them,
+         * and their training counts every coefficient token in the 45 clusters of the map
+         */
+        const uint32_t lz77_min_symbol = fixed_histograms || encoder->hf_token_counts ? 0 : 72;
         memset(&encoder->hf_stream, 0, sizeof(HYDEntropyStream));
-        ret = hyd_entropy_init_stream(&encoder->hf_stream, &encoder->allocator, &encoder->working_writer,
-                                num_syms, hf_cluster_map, 7425, 1, 0, 0, &encoder->error);
+        ret = hyd_entropy_init_stream(&encoder->hf_stream, &encoder->allocator,
+                                code_ahead ? &encoder->hf_writer : &encoder->working_writer,
+                                num_syms, hf_cluster_map, 7425, 1, lz77_min_symbol, 0, &encoder->error);
         if (ret < HYD_ERROR_START)
             goto end;
         ret = hyd_entropy_set_hybrid_config(&encoder->hf_stream, 0, 0, 4, 1, 0);
         if (ret < HYD_ERROR_START)
             goto end;
+        /* each group is flushed on its own, and most fit in the default window */
+        ret = hyd_entropy_set_lz77_window(&encoder->hf_stream, get_lz77_window(encoder, HYD_LZ77_DEFAULT_WINDOW));
+        if (ret < HYD_ERROR_START)
+            goto end;
+        encoder->hf_stream.lz77_start_dists = HF_LZ77_START_DISTS;
+        encoder->hf_stream.merge_clusters = encoder->metadata.merge_clusters;
+        if (fixed_histograms) {
+            /* the histograms trained nearest the distance quantized at, in the log domain */
+            const float log_distance = hyd_approx_log2f(encoder->rc.distance / encoder->rc.scale);
+            size_t best = 0;
+            for (size_t d = 1; d < 4; d++) {
+                if (hyd_abs(hyd_approx_log2f(hf_fixed_distances[d]) - log_distance)
+                        < hyd_abs(hyd_approx_log2f(hf_fixed_distances[best]) - log_distance))
+                    best = d;
+            }
+            ret = hyd_entropy_set_fixed_frequencies(&encoder->hf_stream, hf_fixed_frequencies[best][0], 64);
+            if (ret < HYD_ERROR_START)
+                goto end;
+        }
+        if (code_ahead) {
+            encoder->hf_writer.buffer = hyd_malloc(&encoder->allocator, 1 << 12);
+            encoder->hf_group_end = hyd_calloc(&encoder->allocator, num_frame_groups, sizeof(size_t));
+            if (!encoder->hf_writer.buffer || !encoder->hf_group_end) {
+                ret = HYD_NOMEM;
+                goto end;
+            }
+            hyd_init_bit_writer(&encoder->hf_writer, encoder->hf_writer.buffer, 1 << 12, 0, 0);
+            encoder->hf_writer.allocator = &encoder->allocator;
+            encoder->hf_writer.realloc_func = &realloc_working_buffer;
+        }
     }
 
     if (!encoder->hf_stream_barrier)
@@ -766,25 +1665,66 @@ static HYDStatusCode encode_xyb_buffer(HYDEncoder *encoder, size_t tile_x, size_
         goto end;
     }
 
-    ret = initialize_hf_coeffs(encoder, &encoder->hf_stream, lf_group, non_zero_count,
+    const size_t symbol_start = encoder->hf_stream.symbol_pos;
+    ret = initialize_hf_coeffs(encoder, &encoder->hf_stream, lf_group, non_zero_count, ac_strategy,
             encoder->hf_stream_barrier, non_zeroes, encoder->groups_encoded);
     if (ret < HYD_ERROR_START)
         goto end;
+    if (encoder->hf_token_counts) {
+        for (size_t p = symbol_start; p < encoder->hf_stream.symbol_pos; p++) {
+            HYDHybridSymbol symbol;
+            hyd_entropy_get_symbol(&encoder->hf_stream, p, &symbol);
+            if (symbol.token < 64)
+                encoder->hf_token_counts[symbol.cluster][symbol.token]++;
+        }
+    }
+    const size_t hf_ahead_start = working_bits(&encoder->hf_writer);
+    if (code_ahead) {
+        size_t soff = 0;
+        for (size_t g = encoder->groups_encoded; g < encoder->groups_encoded + num_groups; g++) {
+            ret = hyd_ans_write_stream_symbols(&encoder->hf_stream, soff, encoder->hf_stream_barrier[g]);
+            if (ret < HYD_ERROR_START)
+                goto end;
+            soff += encoder->hf_stream_barrier[g];
+            ret = hyd_bitwriter_flush(&encoder->hf_writer);
+            if (ret < HYD_ERROR_START)
+                goto end;
+            encoder->hf_group_end[g] = encoder->hf_writer.buffer_pos;
+        }
+        hyd_entropy_clear_symbols(&encoder->hf_stream);
+    }
+    if (encoder->rc.budget && encoder->one_frame) {
+        /* unless coded ahead, the stream is written once the frame is complete, so its share is estimated */
+        float hf_bits = working_bits(&encoder->hf_writer) - hf_ahead_start;
+        if (!code_ahead) {
+            ret = hyd_entropy_estimate_bits(&encoder->hf_stream, symbol_start, encoder->metadata.prefix_codes,
+                &hf_bits);
+            if (ret < HYD_ERROR_START)
+                goto end;
+        }
+        rate_control_end_group(encoder, lf_bits, hf_bits);
+    }
     if (encoder->one_frame)
         encoder->groups_encoded += num_groups;
 
     if (encoder->one_frame && !encoder->last_tile)
         goto end;
 
+    const size_t hf_global_start = working_bits(&encoder->working_writer);
     // default params HFGlobal
     hyd_write_bool(&encoder->working_writer, 1);
     // num hf presets
     hyd_write(&encoder->working_writer, 0, hyd_cllog2(num_frame_groups));
     // HF Pass order
     hyd_write(&encoder->working_writer, 2, 2);
-    ret = hyd_ans_write_stream_header(&encoder->hf_stream);
+    encoder->hf_stream.bw = &encoder->working_writer;
+    if (encoder->metadata.prefix_codes)
+        ret = hyd_prefix_write_stream_header(&encoder->hf_stream);
+    else
+        ret = hyd_ans_write_stream_header(&encoder->hf_stream);
     if (ret < HYD_ERROR_START)
         goto end;
+    const size_t hf_start = working_bits(&encoder->working_writer);
     if (num_frame_groups > 1) {
         hyd_bitwriter_flush(&encoder->working_writer);
         encoder->section_endpos[encoder->section_count++] = encoder->working_writer.buffer_pos;
@@ -792,16 +1732,28 @@ static HYDStatusCode encode_xyb_buffer(HYDEncoder *encoder, size_t tile_x, size_
 
     size_t soff = 0;
     for (size_t g = 0; g < num_frame_groups; g++) {
-        ret = hyd_ans_write_stream_symbols(&encoder->hf_stream, soff, encoder->hf_stream_barrier[g]);
+        if (code_ahead) {
+            const size_t start = soff;
+            soff = hyd_max(encoder->hf_group_end[g], start);
+            ret = hyd_write_bytes(&encoder->working_writer, encoder->hf_writer.buffer + start, soff - start);
+        } else if (encoder->metadata.prefix_codes) {
+            ret = hyd_prefix_write_stream_symbols(&encoder->hf_stream, soff, encoder->hf_stream_barrier[g]);
+            soff += encoder->hf_stream_barrier[g];
+        } else {
+            ret = hyd_ans_write_stream_symbols(&encoder->hf_stream, soff, encoder->hf_stream_barrier[g]);
+            soff += encoder->hf_stream_barrier[g];
+        }
         if (ret < HYD_ERROR_START)
             goto end;
-        soff += encoder->hf_stream_barrier[g];
         if (num_frame_groups > 1) {
             hyd_bitwriter_flush(&encoder->working_writer);
             encoder->section_endpos[encoder->section_count++] = encoder->working_writer.buffer_pos;
         }
     }
-    encoder->hf_stream.symbol_pos = 0;
+    hyd_entropy_clear_symbols(&encoder->hf_stream);
+    if (encoder->rc.budget && !encoder->one_frame)
+        rate_control_end_group(encoder, hf_global_start - lf_start,
+            working_bits(&encoder->working_writer) - hf_start);
 
     // write TOC to main buffer
     hyd_bitwriter_flush(&encoder->working_writer);
@@ -812,6 +1764,7 @@ static HYDStatusCode encode_xyb_buffer(HYDEncoder *encoder, size_t tile_x, size_
             return ret;
     }
 
+    const size_t toc_start = working_bits(&encoder->writer);
     hyd_write_zero_pad(&encoder->writer);
 
     if (num_frame_groups > 1) {
@@ -826,86 +1779,123 @@ static HYDStatusCode encode_xyb_buffer(HYDEncoder *encoder, size_t tile_x, size_
     }
 
     hyd_write_zero_pad(&encoder->writer);
+    if (encoder->rc.budget && !encoder->one_frame) {
+        encoder->rc.frame_overhead = hf_start - hf_global_start + working_bits(&encoder->writer) - toc_start;
+        rate_control_overhead(encoder, encoder->rc.frame_overhead);
+    }
 
     encoder->wrote_frame_header = 0;
     ret = hyd_flush(encoder);
     hyd_entropy_stream_destroy(&encoder->hf_stream);
     hyd_freep(&encoder->allocator, &encoder->section_endpos);
     hyd_freep(&encoder->allocator, &encoder->hf_stream_barrier);
+    hyd_freep(&encoder->allocator, &encoder->hf_group_end);
+    hyd_freep(&encoder->allocator, &encoder->hf_writer.buffer);
 
 end:
     hyd_free(&encoder->allocator, non_zeroes);
+    hyd_free(&encoder->allocator, ac_strategy);
+    hyd_free(&encoder->allocator, hf_mult);
+    hyd_free(&encoder->allocator, activity);
+    hyd_free(&encoder->allocator, cost);
+    hyd_free(&encoder->allocator, cfl);
+    hyd_free(&encoder->allocator, rc_cost);
+    hyd_free(&encoder->allocator, block_strip);
     return ret;
 }
 
-static inline float linearize(const float x) {
-    if (x <= 0.0404482362771082f)
-        return 0.07739938080495357f * x;
-    return 0.003094300919832f + x * (-0.009982599f + x * (0.72007737769f + 0.2852804880f * x));
-}
+/*
+ * Loads count pixels of one row into planar floats.
+ * Returns nonzero if any sample is not finite.
+ */
+typedef int (*RowLoader)(float rgb[3][HYD_XYB_BATCH], const void *const buffer[3], ptrdiff_t offset,
+                         ptrdiff_t pixel_stride, size_t count, const float *lut);
 
-static inline float hyd_cbrtf(const float x) {
-    union { float f; uint32_t i; } z = { .f = x };
-    z.i = 0x548c39cb - z.i / 3;
-    z.f *= 1.5015480449f - 0.534850249f * x * z.f * z.f * z.f;
-    z.f *= 1.333333985f - 0.33333333f * x * z.f * z.f * z.f;
-    return 1.0f / z.f;
+/*
+ * A pixel_stride of 0 means the stride is only known at runtime. Known strides
+ * become compile-time constants, which lets the compiler vectorize these loops.
+ */
+#define DEFINE_LUT_LOADER(name, type, stride) \
+static int name(float rgb[3][HYD_XYB_BATCH], const void *const buffer[3], ptrdiff_t offset, \
+                ptrdiff_t pixel_stride, size_t count, const float *lut) { \
+    const ptrdiff_t ps = (stride) ? (stride) : pixel_stride; \
+    for (int c = 0; c < 3; c++) { \
+        const type *samples = (const type *)buffer[c] + offset; \
+        for (size_t x = 0; x < count; x++) \
+            rgb[c][x] = lut[samples[x * ps]]; \
+    } \
+    return 0; \
 }
 
-static inline void rgb_to_xyb(const float rgb[3], float *xyb) {
-    const float lgamma = hyd_cbrtf(0.3f * rgb[0] + 0.622f * rgb[1] + 0.078f * rgb[2]
-        + 0.0037930732552754493f) - 0.155954f;
-    const float mgamma = hyd_cbrtf(0.23f * rgb[0] + 0.692f * rgb[1] + 0.078f * rgb[2]
-        + 0.0037930732552754493f) - 0.155954f;
-    const float sgamma = hyd_cbrtf(0.243423f * rgb[0] + 0.204767f * rgb[1] + 0.55181f * rgb[2]
-        + 0.0037930732552754493f) - 0.155954f;
-    xyb[0] = (lgamma - mgamma) * 0.5f;
-    const float y = xyb[1] = (lgamma + mgamma) * 0.5f;
-    /* chroma-from-luma adds B to Y */
-    xyb[2] = sgamma - y;
+#define DEFINE_FLOAT_LOADER(name, stride) \
+static int name(float rgb[3][HYD_XYB_BATCH], const void *const buffer[3], ptrdiff_t offset, \
+                ptrdiff_t pixel_stride, size_t count, const float *lut) { \
+    const ptrdiff_t ps = (stride) ? (stride) : pixel_stride; \
+    int finite = 1; \
+    for (int c = 0; c < 3; c++) { \
+        const float *samples = (const float *)buffer[c] + offset; \
+        for (size_t x = 0; x < count; x++) { \
+            rgb[c][x] = samples[x * ps]; \
+            finite &= hyd_isfinite(rgb[c][x]); \
+        } \
+    } \
+    return !finite; \
 }
 
+DEFINE_LUT_LOADER(load_u8, uint8_t, 0)
+DEFINE_LUT_LOADER(load_u8_planar, uint8_t, 1)
+DEFINE_LUT_LOADER(load_u8_rgb, uint8_t, 3)
+DEFINE_LUT_LOADER(load_u8_rgba, uint8_t, 4)
+DEFINE_LUT_LOADER(load_u16, uint16_t, 0)
+DEFINE_LUT_LOADER(load_u16_planar, uint16_t, 1)
+DEFINE_LUT_LOADER(load_u16_rgb, uint16_t, 3)
+DEFINE_LUT_LOADER(load_u16_rgba, uint16_t, 4)
+DEFINE_FLOAT_LOADER(load_f32, 0)
+DEFINE_FLOAT_LOADER(load_f32_planar, 1)
+DEFINE_FLOAT_LOADER(load_f32_rgb, 3)
+DEFINE_FLOAT_LOADER(load_f32_rgba, 4)
+
+/* indexed by HYDSampleFormat, then by pixel_stride, with 0 as the generic fallback */
+static const RowLoader row_loaders[3][5] = {
+    {load_u8, load_u8_planar, load_u8, load_u8_rgb, load_u8_rgba},
+    {load_u16, load_u16_planar, load_u16, load_u16_rgb, load_u16_rgba},
+    {load_f32, load_f32_planar, load_f32, load_f32_rgb, load_f32_rgba},
+};
+
 static HYDStatusCode populate_xyb_buffer(HYDEncoder *encoder, const void *const buffer[3],
         ptrdiff_t row_stride, ptrdiff_t pixel_stride, size_t lf_group_id,
         HYDSampleFormat sample_fmt) {
-    for (size_t y = 0; y < encoder->lf_group[lf_group_id].lf_group_height; y++) {
+    const HYDLFGroup *lf_group = &encoder->lf_group[lf_group_id];
+    const RowLoader load_row = row_loaders[sample_fmt][pixel_stride > 0 && pixel_stride < 5 ? pixel_stride : 0];
+    const float *lut = sample_fmt == HYD_UINT8 ? encoder->linear_lut8 : encoder->linear_lut16;
+    /* integer samples are linearized by the lookup tables */
+    const int linearize = sample_fmt == HYD_FLOAT32 && !encoder->metadata.linear_light;
+    float rgb[3][HYD_XYB_BATCH];
+    for (size_t y = 0; y < lf_group->lf_group_height; y++) {
         const ptrdiff_t y_off = y * row_stride;
-        const size_t row = y * encoder->lf_group[lf_group_id].stride;
-        for (size_t x = 0; x < encoder->lf_group[lf_group_id].lf_group_width; x++) {
-            const ptrdiff_t offset = y_off + x * pixel_stride;
-            float rgb[3];
-            switch (sample_fmt) {
-                case HYD_UINT8:
-                    rgb[0] = ((uint8_t *)buffer[0])[offset] * (1.0f / 255.0f);
-                    rgb[1] = ((uint8_t *)buffer[1])[offset] * (1.0f / 255.0f);
-                    rgb[2] = ((uint8_t *)buffer[2])[offset] * (1.0f / 255.0f);
-                    break;
-                case HYD_UINT16:
-                    rgb[0] = ((uint16_t *)buffer[0])[offset] * (1.0f / 65535.0f);
-                    rgb[1] = ((uint16_t *)buffer[1])[offset] * (1.0f / 65535.0f);
-                    rgb[2] = ((uint16_t *)buffer[2])[offset] * (1.0f / 65535.0f);
-                    break;
-                case HYD_FLOAT32:
-                    rgb[0] = ((float *)buffer[0])[offset];
-                    rgb[1] = ((float *)buffer[1])[offset];
-                    rgb[2] = ((float *)buffer[2])[offset];
-                    if (!hyd_isfinite(rgb[0]) || !hyd_isfinite(rgb[1]) || !hyd_isfinite(rgb[2])) {
-                        encoder->error = "Invalid NaN Float";
-                        return HYD_API_ERROR;
-                    }
-                    break;
-                default:
-                    encoder->error = "Invalid Sample Format";
-                    return HYD_INTERNAL_ERROR;
+        const size_t row = y * lf_group->stride;
+        for (size_t bx = 0; bx < lf_group->lf_group_width; bx += HYD_XYB_BATCH) {
+            const size_t count = hyd_min(lf_group->lf_group_width - bx, HYD_XYB_BATCH);
+            if (load_row(rgb, buffer, y_off + bx * pixel_stride, pixel_stride, count, lut)) {
+                encoder->error = "Invalid NaN Float";
+                return HYD_API_ERROR;
             }
-            if (!encoder->metadata.linear_light) {
-                rgb[0] = linearize(rgb[0]);
-                rgb[1] = linearize(rgb[1]);
-                rgb[2] = linearize(rgb[2]);
-            }
-
-            rgb_to_xyb(rgb, &encoder->xyb[3 * (row + x)].f);
+            float *const xyb[3] = {
+                &encoder->xyb[0][row + bx].f, &encoder->xyb[1][row + bx].f, &encoder->xyb[2][row + bx].f,
+            };
+            encoder->xyb_kernel(xyb, rgb, count, linearize);
         }
+        /* the blocks along the right and bottom edges are padded by repeating the last pixel */
+        for (int c = 0; c < 3; c++) {
+            for (size_t x = lf_group->lf_group_width; x < lf_group->stride; x++)
+                encoder->xyb[c][row + x] = encoder->xyb[c][row + lf_group->lf_group_width - 1];
+        }
+    }
+    const size_t last_row = (lf_group->lf_group_height - 1) * lf_group->stride;
+    for (size_t y = lf_group->lf_group_height; y < lf_group->lf_varblock_height << 3; y++) {
+        for (int c = 0; c < 3; c++)
+            memcpy(encoder->xyb[c] + y * lf_group->stride, encoder->xyb[c] + last_row,
+                lf_group->stride * sizeof(XYBEntry));
     }
 
     return HYD_OK;
@@ -925,6 +1915,13 @@ HYDRIUM_EXPORT HYDStatusCode hyd_send_tile(HYDEncoder *encoder, const void *cons
     if (ret < HYD_ERROR_START)
         return ret;
 
+    if (sample_fmt == HYD_UINT16 && !encoder->linear_lut16) {
+        encoder->linear_lut16 = hyd_mallocarray(&encoder->allocator, UINT16_MAX + 1, sizeof(float));
+        if (!encoder->linear_lut16)
+            return HYD_NOMEM;
+        hyd_xyb_fill_linear_lut(encoder->linear_lut16, UINT16_MAX, !encoder->metadata.linear_light);
+    }
+
     size_t lfid = encoder->one_frame ? tile_y * encoder->lf_group_count_x + tile_x : 0;
 
     ret = populate_xyb_buffer(encoder, buffer, row_stride, pixel_stride, lfid, sample_fmt);
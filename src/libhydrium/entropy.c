@@ -9,34 +9,21 @@
 #include "math-functions.h"
 #include "memory.h"
 
-// State Flush. Monsieur Bond Wins.
-typedef struct StateFlush {
-    size_t token_index;
-    uint16_t value;
-} StateFlush;
-
-typedef struct StateFlushChain {
-    StateFlush *state_flushes;
-    size_t pos;
-    size_t capacity;
-    struct StateFlushChain *prev_chain;
-} StateFlushChain;
-
-typedef struct FrequencyEntry {
+typedef struct HuffmanItem {
+    uint64_t weight;
+    /* the token of a leaf, or -1 for a node made of two others */
     int32_t token;
-    uint32_t frequency;
-    int32_t depth;
-    int32_t max_depth;
-    struct FrequencyEntry *left_child;
-    struct FrequencyEntry *right_child;
-} FrequencyEntry;
+} HuffmanItem;
 
 static const HYDVLCElement ans_dist_prefix_lengths[14] = {
     {17, 5}, {11, 4}, {15, 4}, {3, 4}, {9, 4},  {7, 4},  {4, 3},
     {2, 3},  {5, 3},  {6, 3},  {0, 3}, {33, 6}, {1, 7}, {65, 7},
 };
 
-static const HYDHybridUintConfig lz77_len_conf = {7, 0, 0};
+static const HYDHybridUintConfig lz77_len_conf = {0, 0, 0};
+
+/* the frequency tables hold every ANS token from the start, and only grow for larger prefix alphabets */
+#define FREQUENCY_TABLE_SIZE 256
 
 static const uint32_t prefix_zig_zag[18] = {1, 2, 3, 4, 0, 5, 17, 6, 16, 7, 8, 9, 10, 11, 12, 13, 14, 15};
 
@@ -80,18 +67,16 @@ void hyd_entropy_stream_destroy(HYDEntropyStream *stream) {
         hyd_free(stream->allocator, stream->frequencies);
     }
     hyd_free(stream->allocator, stream->cluster_map);
-    hyd_free(stream->allocator, stream->symbols);
-    hyd_free(stream->allocator, stream->configs);
-    if (stream->alias_table) {
-        for (size_t i = 0; i < stream->num_clusters; i++) {
-            if (stream->alias_table[i]) {
-                for (size_t j = 0; j < stream->alphabet_sizes[i]; j++)
-                    hyd_free(stream->allocator, stream->alias_table[i][j].cutoffs);
-                hyd_free(stream->allocator, stream->alias_table[i]);
-            }
-        }
-        hyd_free(stream->allocator, stream->alias_table);
+    if (stream->symbol_chunks) {
+        for (size_t i = 0; i < stream->chunk_count; i++)
+            hyd_free(stream->allocator, stream->symbol_chunks[i]);
+        hyd_free(stream->allocator, stream->symbol_chunks);
     }
+    hyd_free(stream->allocator, stream->escapes);
+    hyd_free(stream->allocator, stream->lz77_symbols);
+    hyd_free(stream->allocator, stream->configs);
+    hyd_free(stream->allocator, stream->encode_table);
+    hyd_free(stream->allocator, stream->ans_output);
     if (stream->vlc_table) {
         for (size_t i = 0; i < stream->num_clusters; i++)
             hyd_free(stream->allocator, stream->vlc_table[i]);
@@ -193,6 +178,11 @@ static HYDStatusCode write_hybrid_uint_config(HYDEntropyStream *stream, const HY
     return bw->overflow_state;
 }
 
+/*
+ * Build the alias mapping of a cluster, as the decoder does, and invert it into the encode table,
+ * so that the slot of every symbol and offset below its frequency is one lookup away. Also set up
+ * the division by each frequency.
+ */
 static HYDStatusCode generate_alias_mapping(HYDEntropyStream *stream, size_t cluster,
         int log_alphabet_size, int32_t uniq_pos) {
     int log_bucket_size = 12 - log_alphabet_size;
@@ -201,14 +191,29 @@ static HYDStatusCode generate_alias_mapping(HYDEntropyStream *stream, size_t clu
     uint32_t symbols[256] = { 0 };
     uint32_t cutoffs[256] = { 0 };
     uint32_t offsets[256] = { 0 };
-    HYDAliasEntry *alias_table = stream->alias_table[cluster];
+    HYDANSEncodeTable *table = &stream->encode_table[cluster];
+
+    uint32_t start = 0;
+    for (uint32_t sym = 0; sym < stream->alphabet_sizes[cluster]; sym++) {
+        const uint32_t freq = stream->frequencies[cluster][sym];
+        HYDANSEncodeEntry *entry = &table->entries[sym];
+        entry->frequency = freq;
+        entry->start = start;
+        start += freq;
+        if (!freq)
+            continue;
+        /* exact for every 32-bit dividend, with l = ceil(log2(freq)) */
+        const int l = hyd_cllog2(freq);
+        entry->reciprocal = (uint32_t)((((uint64_t)1 << 32) * ((UINT64_C(1) << l) - freq)) / freq + 1);
+        entry->shift1 = hyd_min(l, 1);
+        entry->shift2 = hyd_max(l - 1, 0);
+    }
 
     if (uniq_pos >= 0) {
         for (uint32_t i = 0; i < table_size; i++) {
             symbols[i] = uniq_pos;
             offsets[i] = i * bucket_size;
         }
-        alias_table[uniq_pos].count = table_size;
     } else {
         size_t underfull_pos = 0;
         size_t overfull_pos = 0;
@@ -248,30 +253,20 @@ static HYDStatusCode generate_alias_mapping(HYDEntropyStream *stream, size_t clu
             } else {
                 offsets[sym] -= cutoffs[sym];
             }
-            alias_table[symbols[sym]].count++;
         }
     }
 
-    for (uint32_t sym = 0; sym < stream->alphabet_sizes[cluster]; sym++) {
-        alias_table[sym].cutoffs = hyd_mallocarray(stream->allocator, 3 * (alias_table[sym].count + 1),
-            sizeof(int32_t));
-        if (!alias_table[sym].cutoffs)
-            return HYD_NOMEM;
-        memset(alias_table[sym].cutoffs, -1, 3 * (alias_table[sym].count + 1) * sizeof(int32_t));
-        alias_table[sym].offsets = alias_table[sym].cutoffs + alias_table[sym].count + 1;
-        alias_table[sym].original = alias_table[sym].offsets + alias_table[sym].count + 1;
-        alias_table[sym].offsets[0] = 0;
-        alias_table[sym].cutoffs[0] = cutoffs[sym];
-        alias_table[sym].original[0] = sym;
-    }
-
-    for (uint32_t i = 0; i < table_size; i++) {
-        size_t j = 1;
-        while (alias_table[symbols[i]].cutoffs[j] >= 0)
-            j++;
-        alias_table[symbols[i]].cutoffs[j] = cutoffs[i];
-        alias_table[symbols[i]].offsets[j] = offsets[i];
-        alias_table[symbols[i]].original[j] = i;
+    /* the slot at pos in bucket i decodes to i below the cutoff, and to its alias from there */
+    for (uint32_t slot = 0; slot < 1 << 12; slot++) {
+        const uint32_t i = slot >> log_bucket_size;
+        const uint32_t pos = slot & (bucket_size - 1);
+        const uint32_t sym = pos < cutoffs[i] ? i : symbols[i];
+        const uint32_t offset = pos < cutoffs[i] ? pos : offsets[i] + pos;
+        if (sym >= stream->alphabet_sizes[cluster] || offset >= table->entries[sym].frequency) {
+            *stream->error = "alias table lookup failed";
+            return HYD_INTERNAL_ERROR;
+        }
+        table->slots[table->entries[sym].start + offset] = slot;
     }
 
     return HYD_OK;
@@ -359,8 +354,19 @@ static int32_t write_ans_frequencies(HYDEntropyStream *stream, uint32_t *frequen
     int log_counts[256];
     size_t omit_pos = 0;
     size_t omit_log = 0;
-    for (size_t k = 0; k < alphabet_size; k++) {
+    for (size_t k = 0; k < alphabet_size; k++)
         log_counts[k] = frequencies[k] ? 1 + hyd_fllog2(frequencies[k]) : 0;
+    for (size_t k = 0; k < alphabet_size; k++) {
+        /* code 13 repeats the previous count, so runs of zeros after a zero cost one code */
+        size_t run = 0;
+        while (k && !log_counts[k - 1] && k + run < alphabet_size && !log_counts[k + run] && run < 259)
+            run++;
+        if (run >= 4) {
+            hyd_write(bw, ans_dist_prefix_lengths[13].symbol, ans_dist_prefix_lengths[13].length);
+            write_ans_u8(bw, run - 4);
+            k += run - 1;
+            continue;
+        }
         hyd_write(bw, ans_dist_prefix_lengths[log_counts[k]].symbol, ans_dist_prefix_lengths[log_counts[k]].length);
         if (log_counts[k] > omit_log) {
             omit_log = log_counts[k];
@@ -391,18 +397,26 @@ HYDStatusCode hyd_entropy_init_stream(HYDEntropyStream *stream, HYDAllocator *al
         num_dists++;
         stream->lz77_min_length = 3;
         stream->lz77_min_symbol = lz77_min_symbol;
+        stream->lz77_window = HYD_LZ77_DEFAULT_WINDOW;
     }
     stream->num_dists = num_dists;
     stream->allocator = allocator;
     stream->bw = bw;
     stream->modular = modular;
-    stream->symbol_count = symbol_count;
+    /* further chunks are only allocated once they are needed */
+    stream->symbol_count = hyd_min(symbol_count, 1 << HYD_SYMBOL_CHUNK_SHIFT);
     stream->cluster_map = hyd_malloc(allocator, num_dists);
-    stream->symbols = hyd_mallocarray(allocator, stream->symbol_count, sizeof(HYDHybridSymbol));
-    if (!stream->cluster_map || !stream->symbols) {
+    stream->symbol_chunks = hyd_malloc(allocator, sizeof(uint32_t *));
+    if (!stream->cluster_map || !stream->symbol_chunks) {
         ret = HYD_NOMEM;
         goto fail;
     }
+    stream->symbol_chunks[0] = hyd_mallocarray(allocator, stream->symbol_count, sizeof(uint32_t));
+    if (!stream->symbol_chunks[0]) {
+        ret = HYD_NOMEM;
+        goto fail;
+    }
+    stream->chunk_count = 1;
     memcpy(stream->cluster_map, cluster_map, num_dists - !!lz77_min_symbol);
     for (size_t i = 0; i < num_dists - !!lz77_min_symbol; i++) {
         if (stream->cluster_map[i] >= stream->num_clusters)
@@ -419,10 +433,19 @@ HYDStatusCode hyd_entropy_init_stream(HYDEntropyStream *stream, HYDAllocator *al
 
     stream->configs = hyd_mallocarray(allocator, stream->num_clusters, sizeof(HYDHybridUintConfig));
     stream->alphabet_sizes = hyd_calloc(allocator, stream->num_clusters, sizeof(uint32_t));
-    if (!stream->configs || !stream->alphabet_sizes) {
+    stream->frequencies = hyd_calloc(allocator, stream->num_clusters, sizeof(uint32_t *));
+    if (!stream->configs || !stream->alphabet_sizes || !stream->frequencies) {
         ret = HYD_NOMEM;
         goto fail;
     }
+    /* the symbols are counted as they are sent, so the header needs no pass over them */
+    for (size_t c = 0; c < stream->num_clusters; c++) {
+        stream->frequencies[c] = hyd_calloc(allocator, FREQUENCY_TABLE_SIZE, sizeof(uint32_t));
+        if (!stream->frequencies[c]) {
+            ret = HYD_NOMEM;
+            goto fail;
+        }
+    }
 
     if (!custom_configs) {
         hyd_entropy_set_hybrid_config(stream, 0, stream->num_clusters - !!stream->lz77_min_symbol, 4, 1, 1);
@@ -456,24 +479,84 @@ static void hybridize(uint32_t symbol, HYDHybridSymbol *hybrid_symbol, const HYD
     }
 }
 
+/*
+ * The first chunk doubles until it is full sized, so that small streams stay small, and then
+ * whole chunks are added, so that the symbols sent so far are never copied.
+ */
+static HYDStatusCode grow_symbols(HYDEntropyStream *stream) {
+    const size_t chunk_size = 1 << HYD_SYMBOL_CHUNK_SHIFT;
+    if (stream->symbol_count < chunk_size) {
+        const size_t symbol_count = hyd_min(stream->symbol_count << 1, chunk_size);
+        uint32_t *chunk = hyd_reallocarray(stream->allocator, stream->symbol_chunks[0], symbol_count,
+            sizeof(uint32_t));
+        if (!chunk)
+            return HYD_NOMEM;
+        stream->symbol_chunks[0] = chunk;
+        stream->symbol_count = symbol_count;
+        return HYD_OK;
+    }
+    uint32_t **chunks = hyd_reallocarray(stream->allocator, stream->symbol_chunks, stream->chunk_count + 1,
+        sizeof(uint32_t *));
+    if (!chunks)
+        return HYD_NOMEM;
+    stream->symbol_chunks = chunks;
+    chunks[stream->chunk_count] = hyd_mallocarray(stream->allocator, chunk_size, sizeof(uint32_t));
+    if (!chunks[stream->chunk_count])
+        return HYD_NOMEM;
+    stream->chunk_count++;
+    stream->symbol_count += chunk_size;
+    return HYD_OK;
+}
+
 static HYDStatusCode send_hybridized_symbol(HYDEntropyStream *stream, const HYDHybridSymbol *symbol) {
+    HYDStatusCode ret;
     if (stream->wrote_stream_header) {
         *stream->error = "Illegal send after stream header";
         return HYD_INTERNAL_ERROR;
     }
-    if (stream->symbol_pos >= stream->symbol_count) {
-        HYDHybridSymbol *symbols = hyd_reallocarray(stream->allocator, stream->symbols, stream->symbol_count << 1,
-            sizeof(HYDHybridSymbol));
-        if (!symbols)
-            return HYD_NOMEM;
-        stream->symbols = symbols;
-        stream->symbol_count <<= 1;
+    if (stream->symbol_pos >= stream->symbol_count && (ret = grow_symbols(stream)) < HYD_ERROR_START)
+        return ret;
+    if (stream->fixed_frequencies && (symbol->token >= stream->alphabet_sizes[symbol->cluster] ||
+            !stream->frequencies[symbol->cluster][symbol->token])) {
+        *stream->error = "symbol outside the fixed frequencies";
+        return HYD_INTERNAL_ERROR;
+    }
+    uint32_t packed;
+    if (symbol->token < 256 && symbol->residue_bits <= HYD_PACKED_RESIDUE_BITS) {
+        packed = ((uint32_t)symbol->token << 23) | ((uint32_t)symbol->cluster << 15)
+            | ((uint32_t)symbol->residue_bits << HYD_PACKED_RESIDUE_BITS) | symbol->residue;
+    } else {
+        if (stream->escape_pos >= stream->escape_count) {
+            const size_t escape_count = stream->escape_count ? stream->escape_count << 1 : 64;
+            HYDHybridSymbol *escapes = hyd_reallocarray(stream->allocator, stream->escapes, escape_count,
+                sizeof(HYDHybridSymbol));
+            if (!escapes)
+                return HYD_NOMEM;
+            stream->escapes = escapes;
+            stream->escape_count = escape_count;
+        }
+        stream->escapes[stream->escape_pos] = *symbol;
+        packed = HYD_PACKED_ESCAPE | stream->escape_pos++;
     }
-    stream->symbols[stream->symbol_pos++] = *symbol;
+    stream->symbol_chunks[stream->symbol_pos >> HYD_SYMBOL_CHUNK_SHIFT]
+        [stream->symbol_pos & ((1 << HYD_SYMBOL_CHUNK_SHIFT) - 1)] = packed;
+    stream->symbol_pos++;
     if (symbol->token >= stream->max_alphabet_size)
         stream->max_alphabet_size = 1 + symbol->token;
-    if (symbol->token >= stream->alphabet_sizes[symbol->cluster])
+    if (symbol->token >= stream->alphabet_sizes[symbol->cluster]) {
+        const uint32_t capacity = hyd_max(FREQUENCY_TABLE_SIZE, stream->alphabet_sizes[symbol->cluster]);
+        if (symbol->token >= capacity) {
+            uint32_t *frequencies = hyd_reallocarray(stream->allocator, stream->frequencies[symbol->cluster],
+                1 + symbol->token, sizeof(uint32_t));
+            if (!frequencies)
+                return HYD_NOMEM;
+            memset(frequencies + capacity, 0, (1 + symbol->token - capacity) * sizeof(uint32_t));
+            stream->frequencies[symbol->cluster] = frequencies;
+        }
         stream->alphabet_sizes[symbol->cluster] = 1 + symbol->token;
+    }
+    if (!stream->fixed_frequencies)
+        stream->frequencies[symbol->cluster][symbol->token]++;
     return HYD_OK;
 }
 
@@ -484,52 +567,283 @@ static HYDStatusCode send_entropy_symbol0(HYDEntropyStream *stream, size_t dist,
     return send_hybridized_symbol(stream, &hybrid_symbol);
 }
 
-static HYDStatusCode flush_lz77(HYDEntropyStream *stream) {
+/*
+ * LZ77 over the symbols held back, greedily taking the longest match that hash chains find
+ * within the window. Copies reproduce the values sent regardless of their dists, so matches are
+ * searched over the values alone, and the length is coded in the dist of the first symbol copied.
+ */
+#define LZ77_HASH_BITS 14
+#define LZ77_CHAIN_DEPTH 32
+#define LZ77_FAR_LENGTH 64
+
+static inline uint32_t lz77_hash(const HYDLZ77Symbol *symbols) {
+    const uint32_t h = symbols[0].value * 0x9E3779B1u ^ symbols[1].value * 0x85EBCA77u ^ symbols[2].value * 0xC2B2AE3Du;
+    return h >> (32 - LZ77_HASH_BITS);
+}
+
+static HYDStatusCode send_lz77_copy(HYDEntropyStream *stream, uint32_t dist, size_t length, size_t distance) {
     HYDStatusCode ret;
-    uint32_t last_symbol = stream->last_symbol - 1;
-
-    if (stream->lz77_rle_count > stream->lz77_min_length) {
-        uint32_t repeat_count = stream->lz77_rle_count - stream->lz77_min_length;
-        HYDHybridSymbol hybrid_symbol;
-        hybridize(repeat_count, &hybrid_symbol, &lz77_len_conf);
-        hybrid_symbol.cluster = stream->cluster_map[stream->last_dist];
-        hybrid_symbol.token += stream->lz77_min_symbol;
-        if ((ret = send_hybridized_symbol(stream, &hybrid_symbol)) < HYD_ERROR_START)
-            return ret;
-        if ((ret = send_entropy_symbol0(stream, stream->num_dists - 1, !!stream->modular)) < HYD_ERROR_START)
-            return ret;
-    } else if (stream->last_symbol && stream->lz77_rle_count) {
-        for (uint32_t k = 0; k < stream->lz77_rle_count; k++) {
-            if ((ret = send_entropy_symbol0(stream, stream->last_dist, last_symbol)) < HYD_ERROR_START)
-                return ret;
+    HYDHybridSymbol hybrid_symbol;
+    hybridize(length - stream->lz77_min_length, &hybrid_symbol, &lz77_len_conf);
+    hybrid_symbol.cluster = stream->cluster_map[dist];
+    hybrid_symbol.token += stream->lz77_min_symbol;
+    if ((ret = send_hybridized_symbol(stream, &hybrid_symbol)) < HYD_ERROR_START)
+        return ret;
+    /*
+     * modular streams use special distances below 120 that depend on the image width,
+     * of which only the second, one symbol back, is known here
+     */
+    const uint32_t distance_symbol = !stream->modular ? distance - 1 : distance == 1 ? 1 : distance + 119;
+    return send_entropy_symbol0(stream, stream->num_dists - 1, distance_symbol);
+}
+
+HYDStatusCode hyd_entropy_flush_lz77(HYDEntropyStream *stream) {
+    HYDStatusCode ret = HYD_OK;
+    const HYDLZ77Symbol *symbols = stream->lz77_symbols;
+    const size_t count = stream->lz77_count;
+    const size_t window = hyd_min(stream->lz77_window, count);
+    int32_t *head = NULL, *prev = NULL;
+    if (!count)
+        return HYD_OK;
+    head = hyd_mallocarray(stream->allocator, 1 << LZ77_HASH_BITS, sizeof(int32_t));
+    prev = hyd_mallocarray(stream->allocator, window, sizeof(int32_t));
+    if (!head || !prev) {
+        ret = HYD_NOMEM;
+        goto end;
+    }
+    memset(head, 0xFF, (1 << LZ77_HASH_BITS) * sizeof(int32_t));
+
+    size_t pos = 0;
+    while (pos < count) {
+        size_t best_length = 0, best_distance = 0;
+        const int can_start = !stream->lz77_start_dists || symbols[pos].dist < stream->lz77_start_dists;
+        if (can_start && pos + stream->lz77_min_length <= count) {
+            int32_t candidate = head[lz77_hash(symbols + pos)];
+            for (int depth = 0; depth < LZ77_CHAIN_DEPTH && candidate >= 0 && pos - candidate <= window; depth++) {
+                size_t length = 0;
+                while (pos + length < count && symbols[candidate + length].value == symbols[pos + length].value)
+                    length++;
+                if (length > best_length) {
+                    best_length = length;
+                    best_distance = pos - candidate;
+                }
+                if (pos + length == count)
+                    break;
+                candidate = prev[candidate % window];
+            }
+        }
+        /*
+         * a copy costs a length and a distance, and distances other than one symbol back
+         * take many bits, so those only pay off for long matches
+         */
+        size_t run = 0;
+        while (can_start && pos > 0 && pos + run < count && symbols[pos + run - 1].value == symbols[pos + run].value)
+            run++;
+        if (best_length < LZ77_FAR_LENGTH || best_length < run + LZ77_FAR_LENGTH / 2) {
+            best_length = run;
+            best_distance = 1;
+        }
+        const size_t step = best_length > stream->lz77_min_length ? best_length : 1;
+        if (step > 1)
+            ret = send_lz77_copy(stream, symbols[pos].dist, best_length, best_distance);
+        else
+            ret = send_entropy_symbol0(stream, symbols[pos].dist, symbols[pos].value);
+        if (ret < HYD_ERROR_START)
+            goto end;
+        for (const size_t next = pos + step; pos < next; pos++) {
+            if (pos + stream->lz77_min_length > count)
+                continue;
+            const uint32_t h = lz77_hash(symbols + pos);
+            prev[pos % window] = head[h];
+            head[h] = pos;
         }
     }
+    stream->lz77_count = 0;
 
-    stream->lz77_rle_count = 0;
-
-    return HYD_OK;
+end:
+    hyd_free(stream->allocator, head);
+    hyd_free(stream->allocator, prev);
+    return ret;
 }
 
 HYDStatusCode hyd_entropy_send_symbol(HYDEntropyStream *stream, size_t dist, uint32_t symbol) {
-    HYDStatusCode ret = HYD_OK;
-
     if (!stream->lz77_min_symbol)
         return send_entropy_symbol0(stream, dist, symbol);
 
-    if (stream->last_symbol == symbol + 1 &&
-            stream->cluster_map[stream->last_dist] == stream->cluster_map[dist]) {
-        if (++stream->lz77_rle_count < 128)
-            return HYD_OK;
-        stream->lz77_rle_count--;
+    if (stream->lz77_count >= stream->lz77_capacity) {
+        const size_t capacity = stream->lz77_capacity ? stream->lz77_capacity << 1 : 1 << 10;
+        HYDLZ77Symbol *symbols = hyd_reallocarray(stream->allocator, stream->lz77_symbols, capacity,
+            sizeof(HYDLZ77Symbol));
+        if (!symbols)
+            return HYD_NOMEM;
+        stream->lz77_symbols = symbols;
+        stream->lz77_capacity = capacity;
     }
+    stream->lz77_symbols[stream->lz77_count++] = (HYDLZ77Symbol) { .dist = dist, .value = symbol };
 
-    if ((ret = flush_lz77(stream)) < HYD_ERROR_START)
-        return ret;
+    return HYD_OK;
+}
+
+HYDStatusCode hyd_entropy_set_lz77_window(HYDEntropyStream *stream, uint32_t window) {
+    if (!window || window > 1 << 20) {
+        *stream->error = "LZ77 window out of bounds";
+        return HYD_INTERNAL_ERROR;
+    }
+    stream->lz77_window = window;
+    return HYD_OK;
+}
 
-    stream->last_symbol = symbol + 1;
-    stream->last_dist = dist;
+void hyd_entropy_clear_symbols(HYDEntropyStream *stream) {
+    if (!stream->fixed_frequencies) {
+        for (size_t c = 0; c < stream->num_clusters; c++)
+            memset(stream->frequencies[c], 0, stream->alphabet_sizes[c] * sizeof(uint32_t));
+    }
+    stream->symbol_pos = 0;
+    stream->escape_pos = 0;
+    stream->lz77_count = 0;
+}
+
+/*
+ * Estimated bits of cluster a, merged with cluster b if b is not negative: the tokens at their
+ * empirical entropy, the frequencies about as write_ans_frequencies sends them, and the config.
+ */
+static float cluster_bits(const HYDEntropyStream *stream, size_t a, ptrdiff_t b) {
+    const uint32_t size_a = stream->alphabet_sizes[a];
+    const uint32_t size_b = b >= 0 ? stream->alphabet_sizes[b] : 0;
+    const uint32_t size = hyd_max(size_a, size_b);
+    uint32_t total = 0;
+    for (uint32_t k = 0; k < size; k++)
+        total += (k < size_a ? stream->frequencies[a][k] : 0) + (k < size_b ? stream->frequencies[b][k] : 0);
+    /* hybrid uint config, and the simple dist of an empty cluster */
+    float bits = 7.0f;
+    if (!total)
+        return bits + 3.0f;
+    bits += 16.0f + total * hyd_approx_log2f((float)total);
+    for (uint32_t k = 0; k < size; k++) {
+        const uint32_t n = (k < size_a ? stream->frequencies[a][k] : 0) + (k < size_b ? stream->frequencies[b][k] : 0);
+        if (!n) {
+            bits += ans_dist_prefix_lengths[0].length;
+            continue;
+        }
+        if (n > 1)
+            bits -= n * hyd_approx_log2f((float)n);
+        const int log_count = 1 + hyd_fllog2(hyd_max(((uint64_t)n << 12) / total, 1));
+        bits += ans_dist_prefix_lengths[log_count].length + log_count - 1;
+    }
+    return bits;
+}
+
+static int clusters_mergeable(const HYDEntropyStream *stream, size_t a, size_t b) {
+    const HYDHybridUintConfig *ca = &stream->configs[a], *cb = &stream->configs[b];
+    return ca->split_exponent == cb->split_exponent && ca->msb_in_token == cb->msb_in_token
+        && ca->lsb_in_token == cb->lsb_in_token;
+}
 
-    return send_entropy_symbol0(stream, dist, symbol);
+/*
+ * Greedily merge the pair of clusters whose merged histogram saves the most bits, until no pair
+ * saves any, then renumber the clusters left and remap the dists and the symbols onto them.
+ */
+static HYDStatusCode merge_clusters(HYDEntropyStream *stream) {
+    HYDStatusCode ret = HYD_OK;
+    const size_t num_clusters = stream->num_clusters;
+    uint8_t remap[256];
+    float *bits = hyd_mallocarray(stream->allocator, num_clusters, sizeof(float));
+    float *delta = hyd_mallocarray(stream->allocator, num_clusters * num_clusters, sizeof(float));
+    if (!bits || !delta) {
+        ret = HYD_NOMEM;
+        goto end;
+    }
+
+    for (size_t i = 0; i < num_clusters; i++) {
+        remap[i] = i;
+        bits[i] = cluster_bits(stream, i, -1);
+    }
+    for (size_t i = 0; i < num_clusters; i++) {
+        for (size_t j = i + 1; j < num_clusters; j++) {
+            if (clusters_mergeable(stream, i, j))
+                delta[i * num_clusters + j] = cluster_bits(stream, i, j) - bits[i] - bits[j];
+        }
+    }
+
+    while (1) {
+        size_t a = 0, b = 0;
+        float best = 0.0f;
+        for (size_t i = 0; i < num_clusters; i++) {
+            if (remap[i] != i)
+                continue;
+            for (size_t j = i + 1; j < num_clusters; j++) {
+                if (remap[j] == j && clusters_mergeable(stream, i, j) && delta[i * num_clusters + j] < best) {
+                    best = delta[i * num_clusters + j];
+                    a = i;
+                    b = j;
+                }
+            }
+        }
+        if (best >= 0.0f)
+            break;
+
+        /* fold b into a */
+        if (stream->alphabet_sizes[b] > stream->alphabet_sizes[a]) {
+            const uint32_t capacity = hyd_max(FREQUENCY_TABLE_SIZE, stream->alphabet_sizes[a]);
+            if (stream->alphabet_sizes[b] > capacity) {
+                uint32_t *frequencies = hyd_reallocarray(stream->allocator, stream->frequencies[a],
+                    stream->alphabet_sizes[b], sizeof(uint32_t));
+                if (!frequencies) {
+                    ret = HYD_NOMEM;
+                    goto end;
+                }
+                memset(frequencies + capacity, 0, (stream->alphabet_sizes[b] - capacity) * sizeof(uint32_t));
+                stream->frequencies[a] = frequencies;
+            }
+            stream->alphabet_sizes[a] = stream->alphabet_sizes[b];
+        }
+        for (uint32_t k = 0; k < stream->alphabet_sizes[b]; k++)
+            stream->frequencies[a][k] += stream->frequencies[b][k];
+        hyd_freep(stream->allocator, &stream->frequencies[b]);
+        stream->alphabet_sizes[b] = 0;
+        remap[b] = a;
+        bits[a] += bits[b] + best;
+
+        for (size_t x = 0; x < num_clusters; x++) {
+            if (x == a || remap[x] != x || !clusters_mergeable(stream, a, x))
+                continue;
+            const size_t i = hyd_min(a, x), j = hyd_max(a, x);
+            delta[i * num_clusters + j] = cluster_bits(stream, i, j) - bits[i] - bits[j];
+        }
+    }
+
+    /* clusters only merge into lower ones, so each is renumbered after the one it merged into */
+    size_t count = 0;
+    for (size_t c = 0; c < num_clusters; c++) {
+        if (remap[c] != c) {
+            remap[c] = remap[remap[c]];
+            continue;
+        }
+        stream->frequencies[count] = stream->frequencies[c];
+        stream->alphabet_sizes[count] = stream->alphabet_sizes[c];
+        stream->configs[count] = stream->configs[c];
+        remap[c] = count++;
+    }
+    if (count == num_clusters)
+        goto end;
+    for (size_t c = count; c < num_clusters; c++)
+        stream->frequencies[c] = NULL;
+    stream->num_clusters = count;
+    for (size_t d = 0; d < stream->num_dists; d++)
+        stream->cluster_map[d] = remap[stream->cluster_map[d]];
+    for (size_t pos = 0; pos < stream->symbol_pos; pos++) {
+        uint32_t *packed = &stream->symbol_chunks[pos >> HYD_SYMBOL_CHUNK_SHIFT]
+            [pos & ((1 << HYD_SYMBOL_CHUNK_SHIFT) - 1)];
+        if (!(*packed & HYD_PACKED_ESCAPE))
+            *packed = (*packed & ~(UINT32_C(0xFF) << 15)) | ((uint32_t)remap[(*packed >> 15) & 0xFF] << 15);
+    }
+    for (size_t e = 0; e < stream->escape_pos; e++)
+        stream->escapes[e].cluster = remap[stream->escapes[e].cluster];
+
+end:
+    hyd_free(stream->allocator, bits);
+    hyd_free(stream->allocator, delta);
+    return ret;
 }
 
 static HYDStatusCode stream_header_common(HYDEntropyStream *stream, int *las, int prefix_codes) {
@@ -537,7 +851,7 @@ static HYDStatusCode stream_header_common(HYDEntropyStream *stream, int *las, in
     HYDBitWriter *bw = stream->bw;
     hyd_write_bool(bw, stream->lz77_min_symbol);
     if (stream->lz77_min_symbol) {
-        ret = flush_lz77(stream);
+        ret = hyd_entropy_flush_lz77(stream);
         if (ret < HYD_ERROR_START)
             return ret;
         hyd_write_u32(bw, &min_symbol_table, stream->lz77_min_symbol);
@@ -546,6 +860,10 @@ static HYDStatusCode stream_header_common(HYDEntropyStream *stream, int *las, in
     }
     if (ret < HYD_ERROR_START)
         return ret;
+
+    if (!stream->fixed_frequencies && stream->merge_clusters && (ret = merge_clusters(stream)) < HYD_ERROR_START)
+        return ret;
+
     if ((ret = write_cluster_map(stream)) < HYD_ERROR_START)
         return ret;
 
@@ -564,110 +882,197 @@ static HYDStatusCode stream_header_common(HYDEntropyStream *stream, int *las, in
             return ret;
     }
 
-    /* populate frequencies */
-    stream->frequencies = hyd_calloc(stream->allocator, stream->num_clusters, sizeof(uint32_t *));
-    if (!stream->frequencies)
-        return HYD_NOMEM;
-    for (size_t c = 0; c < stream->num_clusters; c++) {
-        if (!stream->alphabet_sizes[c])
-            continue;
-        stream->frequencies[c] = hyd_calloc(stream->allocator, stream->alphabet_sizes[c], sizeof(uint32_t));
-        if (!stream->frequencies[c])
-            return HYD_NOMEM;
-    }
-    for (size_t pos = 0; pos < stream->symbol_pos; pos++) {
-        const HYDHybridSymbol *sym = &stream->symbols[pos];
-        stream->frequencies[sym->cluster][sym->token]++;
-    }
-
     return bw->overflow_state;
 }
 
-static inline int huffman_compare(const FrequencyEntry *fa, const FrequencyEntry *fb) {
-    return fa->frequency != fb->frequency ?
-        (!fb->frequency ? -1 : !fa->frequency ? 1 : fa->frequency - fb->frequency) :
-        (!fb->token ? -1 : !fa->token ? 1 : fa->token - fb->token);
+static int huffman_compare(const void *a, const void *b) {
+    const HuffmanItem *fa = a, *fb = b;
+    if (fa->weight != fb->weight)
+        return fa->weight < fb->weight ? -1 : 1;
+    return fa->token - fb->token;
 }
 
-static int32_t collect(FrequencyEntry *entry) {
-    if (!entry)
-        return 0;
-    int32_t self = ++entry->depth;
-    int32_t left = collect(entry->left_child);
-    int32_t right = collect(entry->right_child);
-    return entry->max_depth = hyd_max3(self, left, right);
+/*
+ * Optimal code lengths by the two-queue method: the leaves are sorted, and the internal nodes are
+ * created in order of weight, so the two lightest nodes are always at the front of one of the two.
+ * depths holds 2n - 1 entries, the parents of the nodes until their depths replace them.
+ * Returns the longest length.
+ */
+static uint32_t huffman_lengths(const HuffmanItem *leaves, uint32_t n, uint32_t *lengths,
+                                uint64_t *weights, uint32_t *depths) {
+    uint32_t *parents = depths;
+    uint32_t leaf = 0, node = n;
+    for (uint32_t m = n; m < 2 * n - 1; m++) {
+        weights[m] = 0;
+        for (int c = 0; c < 2; c++) {
+            if (leaf < n && (node >= m || leaves[leaf].weight <= weights[node])) {
+                weights[m] += leaves[leaf].weight;
+                parents[leaf++] = m;
+            } else {
+                weights[m] += weights[node];
+                parents[node++] = m;
+            }
+        }
+    }
+    /* parents come after their children, so the depths fill in from the root down */
+    uint32_t max_length = 0;
+    depths[2 * n - 2] = 0;
+    for (int32_t m = 2 * n - 3; m >= 0; m--) {
+        depths[m] = depths[parents[m]] + 1;
+        if (m < n) {
+            lengths[leaves[m].token] = depths[m];
+            max_length = hyd_max(max_length, depths[m]);
+        }
+    }
+    return max_length;
+}
+
+/*
+ * Optimal code lengths of at most max_depth, by package-merge. Each list merges the leaves with
+ * the pairs of the list before it, and of the top list the 2n - 2 lightest items are chosen. A leaf
+ * is as long as the number of lists it is chosen in, and a chosen pair chooses both of its items
+ * in the list before, which are always at the front.
+ */
+static void package_merge(const HuffmanItem *leaves, uint32_t n, uint32_t *lengths,
+                          int32_t max_depth, HuffmanItem *items) {
+    uint32_t list_len[16];
+    memcpy(items, leaves, n * sizeof(HuffmanItem));
+    list_len[0] = n;
+    for (int32_t d = 1; d < max_depth; d++) {
+        const HuffmanItem *prev = items + (d - 1) * 2 * n;
+        HuffmanItem *list = items + d * 2 * n;
+        const uint32_t packages = list_len[d - 1] / 2;
+        uint32_t leaf = 0, package = 0, pos = 0;
+        while (leaf < n || package < packages) {
+            const uint64_t weight = package < packages ? prev[2 * package].weight + prev[2 * package + 1].weight : 0;
+            if (leaf < n && (package >= packages || leaves[leaf].weight <= weight)) {
+                list[pos++] = leaves[leaf++];
+            } else {
+                list[pos++] = (HuffmanItem) { .weight = weight, .token = -1 };
+                package++;
+            }
+        }
+        list_len[d] = pos;
+    }
+    uint32_t count = 2 * n - 2;
+    for (int32_t d = max_depth - 1; d >= 0; d--) {
+        const HuffmanItem *list = items + d * 2 * n;
+        uint32_t packages = 0;
+        for (uint32_t k = 0; k < count; k++) {
+            if (list[k].token >= 0)
+                lengths[list[k].token]++;
+            else
+                packages++;
+        }
+        count = 2 * packages;
+    }
 }
 
 static HYDStatusCode build_huffman_tree(HYDEntropyStream *stream, const uint32_t *frequencies,
                                         uint32_t *lengths, uint32_t alphabet_size, int32_t max_depth) {
     HYDStatusCode ret = HYD_OK;
     HYDAllocator *allocator = stream->allocator;
-    FrequencyEntry *tree = hyd_calloc(allocator, (2 * alphabet_size - 1), sizeof(FrequencyEntry));
-    if (!tree) {
+    HuffmanItem *leaves = hyd_mallocarray(allocator, alphabet_size, sizeof(HuffmanItem));
+    uint64_t *weights = hyd_mallocarray(allocator, 2 * alphabet_size, sizeof(uint64_t));
+    uint32_t *depths = hyd_mallocarray(allocator, 2 * alphabet_size, sizeof(uint32_t));
+    HuffmanItem *items = NULL;
+    if (!leaves || !weights || !depths) {
         ret = HYD_NOMEM;
         goto end;
     }
 
-    uint32_t nz = 0;
+    if (max_depth < 0)
+        max_depth = hyd_cllog2(alphabet_size + 1);
+
+    uint32_t n = 0;
     for (uint32_t token = 0; token < alphabet_size; token++) {
-        tree[token].frequency = frequencies[token];
-        tree[token].token = 1 + token;
-        tree[token].left_child = tree[token].right_child = NULL;
+        lengths[token] = 0;
         if (frequencies[token])
-            nz++;
+            leaves[n++] = (HuffmanItem) { .weight = frequencies[token], .token = token };
     }
-    if (!nz) {
+    if (!n) {
         *stream->error = "No nonzero frequencies";
         ret = HYD_INTERNAL_ERROR;
         goto end;
     }
+    if (max_depth > 15 || n > UINT32_C(1) << max_depth) {
+        *stream->error = "too many symbols for the maximum code length";
+        ret = HYD_INTERNAL_ERROR;
+        goto end;
+    }
+    /* a lone symbol takes no bits at all */
+    if (n == 1)
+        goto end;
 
-    if (max_depth < 0)
-        max_depth = hyd_cllog2(alphabet_size + 1);
+    qsort(leaves, n, sizeof(HuffmanItem), &huffman_compare);
+    if (huffman_lengths(leaves, n, lengths, weights, depths) <= max_depth)
+        goto end;
 
-    for (uint32_t k = 0; k < alphabet_size - 1; k++) {
-        int32_t smallest = -1;
-        int32_t second = -1;
-        int32_t target = max_depth - hyd_cllog2(nz--) + 1;
-        for (uint32_t j = 2 * k; j < alphabet_size + k; j++) {
-            if (!tree[j].frequency)
-                continue;
-            if (tree[j].max_depth >= target)
-                continue;
-            if (smallest < 0 || huffman_compare(&tree[j], &tree[smallest]) < 0) {
-                second = smallest;
-                smallest = j;
-            } else if (second < 0 || huffman_compare(&tree[j], &tree[second]) < 0) {
-                second = j;
-            }
-        }
-        if (smallest < 0) {
-            *stream->error = "couldn't find target";
-            ret = HYD_INTERNAL_ERROR;
-            goto end;
-        }
-        hyd_swap(FrequencyEntry, tree[smallest], tree[2 * k]);
-        if (second < 0)
-            break;
-        if (second == 2 * k)
-            second = smallest;
-        smallest = 2 * k;
-        hyd_swap(FrequencyEntry, tree[second], tree[2 * k + 1]);
-        second = smallest + 1;
-        FrequencyEntry *entry = &tree[alphabet_size + k];
-        entry->frequency = tree[smallest].frequency + tree[second].frequency;
-        entry->left_child = &tree[smallest];
-        entry->right_child = &tree[second];
-        collect(entry);
+    /* rare with real data, as the lengths only run long for very skewed frequencies */
+    items = hyd_mallocarray(allocator, max_depth * 2 * n, sizeof(HuffmanItem));
+    if (!items) {
+        ret = HYD_NOMEM;
+        goto end;
     }
+    for (uint32_t k = 0; k < n; k++)
+        lengths[leaves[k].token] = 0;
+    package_merge(leaves, n, lengths, max_depth, items);
 
-    for (uint32_t j = 0; j < 2 * alphabet_size - 1; j++) {
-        if (tree[j].token)
-            lengths[tree[j].token - 1] = tree[j].depth;
+end:
+    hyd_free(allocator, leaves);
+    hyd_free(allocator, weights);
+    hyd_free(allocator, depths);
+    hyd_free(allocator, items);
+    return ret;
+}
+
+HYDStatusCode hyd_entropy_estimate_bits(HYDEntropyStream *stream, size_t symbol_start, int prefix_codes,
+                                        float *bits) {
+    HYDStatusCode ret = HYD_OK;
+    const size_t alphabet_size = stream->max_alphabet_size;
+    uint32_t *counts = hyd_calloc(stream->allocator, stream->num_clusters * alphabet_size, sizeof(uint32_t));
+    uint32_t *lengths = hyd_mallocarray(stream->allocator, alphabet_size, sizeof(uint32_t));
+    if (!counts || !lengths) {
+        ret = HYD_NOMEM;
+        goto end;
     }
+    float residue_bits = 0.0f;
+    for (size_t pos = symbol_start; pos < stream->symbol_pos; pos++) {
+        HYDHybridSymbol sym;
+        hyd_entropy_get_symbol(stream, pos, &sym);
+        counts[sym.cluster * alphabet_size + sym.token]++;
+        residue_bits += sym.residue_bits;
+    }
+    /*
+     * sum of n log2(total / n) over each cluster is total log2(total) - sum of n log2(n),
+     * and prefix codes take whole bits, which costs the most on the tokens that are near certain
+     */
+    float token_bits = 0.0f;
+    for (size_t c = 0; c < stream->num_clusters; c++) {
+        const uint32_t *const cluster = counts + c * alphabet_size;
+        uint32_t total = 0;
+        for (size_t t = 0; t < alphabet_size; t++)
+            total += cluster[t];
+        if (prefix_codes && total) {
+            ret = build_huffman_tree(stream, cluster, lengths, alphabet_size, 15);
+            if (ret < HYD_ERROR_START)
+                goto end;
+            for (size_t t = 0; t < alphabet_size; t++)
+                token_bits += (float)cluster[t] * lengths[t];
+            continue;
+        }
+        for (size_t t = 0; t < alphabet_size; t++) {
+            if (cluster[t] > 1)
+                token_bits -= cluster[t] * hyd_approx_log2f((float)cluster[t]);
+        }
+        if (total > 1)
+            token_bits += total * hyd_approx_log2f((float)total);
+    }
+    *bits = token_bits + residue_bits;
 
 end:
-    hyd_free(allocator, tree);
+    hyd_free(stream->allocator, counts);
+    hyd_free(stream->allocator, lengths);
     return ret;
 }
 
@@ -950,6 +1355,43 @@ fail:
     return ret;
 }
 
+HYDStatusCode hyd_entropy_set_fixed_frequencies(HYDEntropyStream *stream, const uint16_t *frequencies,
+                                                uint16_t alphabet_size) {
+    HYDStatusCode ret;
+    if (stream->symbol_pos || stream->lz77_min_symbol || alphabet_size > 256) {
+        *stream->error = "fixed frequencies set on an unsupported stream";
+        return HYD_INTERNAL_ERROR;
+    }
+    stream->encode_table = hyd_mallocarray(stream->allocator, stream->num_clusters, sizeof(HYDANSEncodeTable));
+    if (!stream->encode_table)
+        return HYD_NOMEM;
+    stream->max_alphabet_size = alphabet_size;
+    int log_alphabet_size = hyd_cllog2(alphabet_size);
+    if (log_alphabet_size < 5)
+        log_alphabet_size = 5;
+    for (size_t c = 0; c < stream->num_clusters; c++) {
+        stream->alphabet_sizes[c] = alphabet_size;
+        uint32_t total = 0;
+        int32_t uniq_pos = -1;
+        for (size_t k = 0; k < alphabet_size; k++) {
+            stream->frequencies[c][k] = frequencies[c * alphabet_size + k];
+            total += stream->frequencies[c][k];
+            if (stream->frequencies[c][k] == 1 << 12)
+                uniq_pos = k;
+        }
+        if (total != 1 << 12) {
+            *stream->error = "fixed frequencies do not sum to 1 << 12";
+            return HYD_INTERNAL_ERROR;
+        }
+        ret = generate_alias_mapping(stream, c, log_alphabet_size, uniq_pos);
+        if (ret < HYD_ERROR_START)
+            return ret;
+    }
+    stream->fixed_frequencies = 1;
+
+    return HYD_OK;
+}
+
 HYDStatusCode hyd_ans_write_stream_header(HYDEntropyStream *stream) {
 
     HYDStatusCode ret;
@@ -960,16 +1402,9 @@ HYDStatusCode hyd_ans_write_stream_header(HYDEntropyStream *stream) {
     if (ret < HYD_ERROR_START)
         goto fail;
 
-    stream->alias_table = hyd_calloc(stream->allocator, stream->num_clusters, sizeof(HYDAliasEntry *));
-    if (!stream->alias_table) {
-        ret = HYD_NOMEM;
-        goto fail;
-    }
-    for (size_t i = 0; i < stream->num_clusters; i++) {
-        if (!stream->alphabet_sizes[i])
-            continue;
-        stream->alias_table[i] = hyd_calloc(stream->allocator, stream->alphabet_sizes[i], sizeof(HYDAliasEntry));
-        if (!stream->alias_table[i]) {
+    if (!stream->fixed_frequencies) {
+        stream->encode_table = hyd_mallocarray(stream->allocator, stream->num_clusters, sizeof(HYDANSEncodeTable));
+        if (!stream->encode_table) {
             ret = HYD_NOMEM;
             goto fail;
         }
@@ -980,7 +1415,8 @@ HYDStatusCode hyd_ans_write_stream_header(HYDEntropyStream *stream) {
             ret = uniq_pos;
             goto fail;
         }
-        if (!stream->alphabet_sizes[i])
+        /* fixed frequencies are already normalized, and their tables built */
+        if (!stream->alphabet_sizes[i] || stream->fixed_frequencies)
             continue;
         ret = generate_alias_mapping(stream, i, log_alphabet_size, uniq_pos);
         if (ret < HYD_ERROR_START)
@@ -1004,13 +1440,12 @@ HYDStatusCode hyd_prefix_write_stream_symbols(HYDEntropyStream *stream, size_t s
         return HYD_INTERNAL_ERROR;
     }
 
-    const HYDHybridSymbol *symbols = stream->symbols + symbol_start;
-    for (size_t p = 0; p < symbol_count; p++) {
-        size_t cluster = symbols[p].cluster;
-        uint32_t token = symbols[p].token;
-        const HYDVLCElement *entry = &stream->vlc_table[cluster][token];
+    for (size_t p = symbol_start; p < symbol_start + symbol_count; p++) {
+        HYDHybridSymbol sym;
+        hyd_entropy_get_symbol(stream, p, &sym);
+        const HYDVLCElement *entry = &stream->vlc_table[sym.cluster][sym.token];
         hyd_write(bw, entry->symbol, entry->length);
-        hyd_write(bw, symbols[p].residue, symbols[p].residue_bits);
+        hyd_write(bw, sym.residue, sym.residue_bits);
     }
 
     return bw->overflow_state;
@@ -1027,129 +1462,68 @@ end:
     return ret;
 }
 
-static HYDStatusCode append_state_flush(HYDAllocator *allocator, StateFlushChain **flushes,
-                                        size_t token_index, uint16_t value) {
-    if ((*flushes)->pos == (*flushes)->capacity) {
-        StateFlushChain *chain = hyd_malloc(allocator, sizeof(StateFlushChain));
-        if (!chain)
-            return HYD_NOMEM;
-        chain->state_flushes = hyd_mallocarray(allocator, 1 << 10, sizeof(StateFlush));
-        if (!chain->state_flushes){
-            hyd_free(allocator, chain);
-            return HYD_NOMEM;
-        }
-        chain->capacity = 1 << 10;
-        chain->pos = 0;
-        chain->prev_chain = *flushes;
-        *flushes = chain;
-    }
-    (*flushes)->state_flushes[(*flushes)->pos++] = (StateFlush){token_index, value};
+/* entries of the reversed ANS output, a value above its bit count */
+#define ANS_OUTPUT_BITS_SHIFT 6
 
-    return HYD_OK;
-}
-
-static StateFlush *pop_state_flush(HYDAllocator *allocator, StateFlushChain **flushes) {
-    if ((*flushes)->pos > 0)
-        return &(*flushes)->state_flushes[--(*flushes)->pos];
-    StateFlushChain *prev_chain = (*flushes)->prev_chain;
-    if (!prev_chain)
-        return NULL;
-    hyd_free(allocator, (*flushes)->state_flushes);
-    hyd_free(allocator, *flushes);
-    *flushes = prev_chain;
-    return pop_state_flush(allocator, flushes);
+static inline void push_ans_output(uint64_t *output, size_t *pos, uint32_t value, int bits) {
+    output[(*pos)++] = ((uint64_t)value << ANS_OUTPUT_BITS_SHIFT) | bits;
 }
 
 HYDStatusCode hyd_ans_write_stream_symbols(HYDEntropyStream *stream, size_t symbol_start, size_t symbol_count) {
-    HYDStatusCode ret = HYD_OK;
-    StateFlushChain flushes_base = { 0 }, *flushes = &flushes_base;
     HYDBitWriter *bw = stream->bw;
-    int log_alphabet_size = hyd_cllog2(stream->max_alphabet_size);
-    if (log_alphabet_size < 5)
-        log_alphabet_size = 5;
-    const uint32_t log_bucket_size = 12 - log_alphabet_size;
-    const uint32_t pos_mask = ~(~UINT32_C(0) << log_bucket_size);
-    if (!stream->alias_table) {
-        *stream->error = "alias table never generated";
-        ret = HYD_INTERNAL_ERROR;
-        goto end;
+    if (!stream->encode_table) {
+        *stream->error = "encode table never generated";
+        return HYD_INTERNAL_ERROR;
     }
 
     if (symbol_count + symbol_start > stream->symbol_pos) {
         *stream->error = "symbol out of bounds during ans flush";
-        ret = HYD_INTERNAL_ERROR;
-        goto end;
+        return HYD_INTERNAL_ERROR;
     }
 
-    flushes->state_flushes = hyd_mallocarray(stream->allocator, 1024, sizeof(StateFlush));
-    if (!flushes->state_flushes) {
-        ret = HYD_NOMEM;
-        goto end;
+    /* at most a state flush and a residue per symbol, and the final state */
+    const size_t capacity = 2 * symbol_count + 2;
+    if (capacity > stream->ans_output_capacity) {
+        uint64_t *output = hyd_reallocarray(stream->allocator, stream->ans_output, capacity, sizeof(uint64_t));
+        if (!output)
+            return HYD_NOMEM;
+        stream->ans_output = output;
+        stream->ans_output_capacity = capacity;
     }
-    flushes->capacity = 1 << 10;
 
+    /*
+     * the states are coded backwards, so the output is collected in reverse, each residue
+     * ahead of the state flush that the decoder reads before its token
+     */
+    uint64_t *const output = stream->ans_output;
+    size_t pos = 0;
     uint32_t state = 0x130000;
-    const HYDHybridSymbol *symbols = stream->symbols + symbol_start;
     for (size_t p2 = 0; p2 < symbol_count; p2++) {
         const size_t p = symbol_count - p2 - 1;
-        const uint8_t symbol = symbols[p].token;
-        const size_t cluster = symbols[p].cluster;
-        const uint32_t freq = stream->frequencies[cluster][symbol];
+        HYDHybridSymbol sym;
+        hyd_entropy_get_symbol(stream, symbol_start + p, &sym);
+        if (sym.residue_bits)
+            push_ans_output(output, &pos, sym.residue, sym.residue_bits);
+        const HYDANSEncodeTable *table = &stream->encode_table[sym.cluster];
+        const HYDANSEncodeEntry *entry = &table->entries[sym.token];
+        const uint32_t freq = entry->frequency;
         if ((state >> 20) >= freq) {
-            ret = append_state_flush(stream->allocator, &flushes, p, state & 0xFFFF);
-            if (ret < HYD_ERROR_START)
-                goto end;
+            push_ans_output(output, &pos, state & 0xFFFF, 16);
             state >>= 16;
         }
-        const uint32_t div = state / freq;
-        const uint32_t offset = state - div * freq;
-        uint32_t i, pos, j;
-        const HYDAliasEntry *alias = &stream->alias_table[cluster][symbol];
-        for (j = 0; j <= alias->count; j++) {
-            pos = offset - alias->offsets[j];
-            int32_t k = pos - alias->cutoffs[j];
-            if (!(pos & ~pos_mask) && (j > 0 ? k >= 0 : k < 0)) {
-                i = alias->original[j];
-                break;
-            }
-        }
-        if (j > alias->count) {
-            *stream->error = "alias table lookup failed";
-            ret = HYD_INTERNAL_ERROR;
-            goto end;
-        }
-        state = (div << 12) | (i << log_bucket_size) | pos;
-    }
-    ret = append_state_flush(stream->allocator, &flushes, 0, (state >> 16) & 0xFFFF);
-    if (ret < HYD_ERROR_START)
-        goto end;
-    ret = append_state_flush(stream->allocator, &flushes, 0, state & 0xFFFF);
-    if (ret < HYD_ERROR_START)
-        goto end;
-    for (size_t p = 0; p < symbol_count; p++) {
-        StateFlush *flush;
-        while ((flush = pop_state_flush(stream->allocator, &flushes))) {
-            if (p >= flush->token_index) {
-                hyd_write(bw, flush->value, 16);
-            } else {
-                flushes->pos++;
-                break;
-            }
-        }
-        hyd_write(bw, symbols[p].residue, symbols[p].residue_bits);
+        const uint32_t t = (uint32_t)(((uint64_t)state * entry->reciprocal) >> 32);
+        const uint32_t div = (t + ((state - t) >> entry->shift1)) >> entry->shift2;
+        state = (div << 12) | table->slots[entry->start + state - div * freq];
     }
+    push_ans_output(output, &pos, (state >> 16) & 0xFFFF, 16);
+    push_ans_output(output, &pos, state & 0xFFFF, 16);
 
-    ret = bw->overflow_state;
-
-end:
-    while (flushes->prev_chain) {
-        StateFlushChain *prev = flushes->prev_chain;
-        hyd_free(stream->allocator, flushes->state_flushes);
-        hyd_free(stream->allocator, flushes);
-        flushes = prev;
+    while (pos > 0) {
+        const uint64_t entry = output[--pos];
+        hyd_write(bw, entry >> ANS_OUTPUT_BITS_SHIFT, entry & ((1 << ANS_OUTPUT_BITS_SHIFT) - 1));
     }
-    hyd_free(stream->allocator, flushes->state_flushes);
-    return ret;
+
+    return bw->overflow_state;
 }
 
 HYDStatusCode hyd_ans_finalize_stream(HYDEntropyStream *stream) {
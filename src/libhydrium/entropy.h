@@ -13,12 +13,40 @@ typedef struct HYDHybridSymbol {
     uint32_t residue;
 } HYDHybridSymbol;
 
-typedef struct HYDAliasEntry {
-    size_t count;
-    int32_t *cutoffs;
-    int32_t *offsets;
-    int32_t *original;
-} HYDAliasEntry;
+/*
+ * Symbols are stored packed in four bytes: the token, the cluster, and a residue of up to
+ * HYD_PACKED_RESIDUE_BITS bits. Any other symbol escapes to a side array, which the packed
+ * entry indexes instead, with the top bit set.
+ */
+#define HYD_PACKED_RESIDUE_BITS 11
+#define HYD_PACKED_ESCAPE (UINT32_C(1) << 31)
+/* symbol storage grows in chunks of this many entries, the first growing up to it */
+#define HYD_SYMBOL_CHUNK_SHIFT 14
+
+/* symbols held back for the LZ77 match search, as sent */
+typedef struct HYDLZ77Symbol {
+    uint32_t dist;
+    uint32_t value;
+} HYDLZ77Symbol;
+
+/* matches are searched this far back by default, and the decoder keeps 1 << 20 */
+#define HYD_LZ77_DEFAULT_WINDOW (1 << 16)
+
+typedef struct HYDANSEncodeEntry {
+    /* multiplier and shifts that divide by frequency, after Granlund and Montgomery */
+    uint32_t reciprocal;
+    uint8_t shift1;
+    uint8_t shift2;
+    uint16_t frequency;
+    /* index of the first slot of the symbol in the slots of its cluster */
+    uint16_t start;
+} HYDANSEncodeEntry;
+
+/* per-cluster tables that map a symbol and a state modulo its frequency to its slot */
+typedef struct HYDANSEncodeTable {
+    HYDANSEncodeEntry entries[256];
+    uint16_t slots[1 << 12];
+} HYDANSEncodeTable;
 
 typedef struct HYDHybridUintConfig {
     uint8_t split_exponent;
@@ -37,33 +65,61 @@ typedef struct HYDEntropyStream {
     size_t num_dists;
     uint8_t *cluster_map;
     size_t num_clusters;
+    /* allocated capacity in symbols */
     size_t symbol_count;
     size_t symbol_pos;
-    HYDHybridSymbol *symbols;
+    uint32_t **symbol_chunks;
+    size_t chunk_count;
+    HYDHybridSymbol *escapes;
+    size_t escape_count;
+    size_t escape_pos;
     uint16_t max_alphabet_size;
     uint16_t *alphabet_sizes;
     uint32_t **frequencies;
     HYDHybridUintConfig *configs;
     int wrote_stream_header;
+    /* the frequencies are set ahead of time, instead of counted from the symbols */
+    int fixed_frequencies;
+    /* merge clusters whose symbols code smaller together, before writing the header */
+    int merge_clusters;
 
     // lz77 only
     uint32_t lz77_min_length;
     uint32_t lz77_min_symbol;
-    uint32_t last_symbol;
-    uint32_t last_dist;
-    uint32_t lz77_rle_count;
+    uint32_t lz77_window;
+    /* if nonzero, copies only start at symbols of dists below this */
+    uint32_t lz77_start_dists;
+    HYDLZ77Symbol *lz77_symbols;
+    size_t lz77_count;
+    size_t lz77_capacity;
     int modular;
 
     // prefix only
     HYDVLCElement **vlc_table;
 
     // ans only
-    HYDAliasEntry **alias_table;
+    HYDANSEncodeTable *encode_table;
+    /* reused between calls to write the symbols */
+    uint64_t *ans_output;
+    size_t ans_output_capacity;
 
     // in case of error, break glass
     const char **error;
 } HYDEntropyStream;
 
+static inline void hyd_entropy_get_symbol(const HYDEntropyStream *stream, size_t pos, HYDHybridSymbol *symbol) {
+    const uint32_t packed = stream->symbol_chunks[pos >> HYD_SYMBOL_CHUNK_SHIFT]
+        [pos & ((1 << HYD_SYMBOL_CHUNK_SHIFT) - 1)];
+    if (packed & HYD_PACKED_ESCAPE) {
+        *symbol = stream->escapes[packed & ~HYD_PACKED_ESCAPE];
+        return;
+    }
+    symbol->token = packed >> 23;
+    symbol->cluster = (packed >> 15) & 0xFF;
+    symbol->residue_bits = (packed >> HYD_PACKED_RESIDUE_BITS) & 0xF;
+    symbol->residue = packed & ((1 << HYD_PACKED_RESIDUE_BITS) - 1);
+}
+
 HYDStatusCode hyd_entropy_init_stream(HYDEntropyStream *stream, HYDAllocator *allocator, HYDBitWriter *bw,
                                       size_t symbol_count, const uint8_t *cluster_map, size_t num_dists,
                                       int custom_configs, uint32_t lz77_min_symbol, int modular, const char **error);
@@ -71,6 +127,44 @@ HYDStatusCode hyd_entropy_set_hybrid_config(HYDEntropyStream *stream, uint8_t mi
                                             int split_exponent, int msb_in_token, int lsb_in_token);
 HYDStatusCode hyd_entropy_send_symbol(HYDEntropyStream *stream, size_t dist, uint32_t symbol);
 
+/**
+ * @brief Search the symbols held back for LZ77 matches and send them, so that no copy reaches
+ * back past this point. Sections the decoder reads on their own must each end with this.
+ * @return HYDStatusCode HYD_OK upon success, negative upon error.
+ */
+HYDStatusCode hyd_entropy_flush_lz77(HYDEntropyStream *stream);
+
+/**
+ * @brief Set how far back LZ77 matches are searched, at most 1 << 20 symbols.
+ * @return HYDStatusCode HYD_OK upon success, negative upon error.
+ */
+HYDStatusCode hyd_entropy_set_lz77_window(HYDEntropyStream *stream, uint32_t window);
+
+/**
+ * @brief Drop the symbols sent so far, keeping their storage for the next ones.
+ */
+void hyd_entropy_clear_symbols(HYDEntropyStream *stream);
+
+/**
+ * @brief Code every cluster with the given frequencies, instead of counting them from the symbols.
+ * frequencies holds alphabet_size entries per cluster, each row summing to 1 << 12, and every
+ * token a symbol may take must have a nonzero frequency. The ANS encode tables are built right
+ * away, so that symbols may be written before the stream header.
+ * @return HYDStatusCode HYD_OK upon success, negative upon error.
+ */
+HYDStatusCode hyd_entropy_set_fixed_frequencies(HYDEntropyStream *stream, const uint16_t *frequencies,
+                                                uint16_t alphabet_size);
+
+/**
+ * @brief Estimate the coded size of the symbols sent from symbol_start onward, as the empirical
+ * entropy of their tokens within each cluster plus their raw residue bits. With prefix_codes,
+ * the tokens take the lengths of the prefix codes of their clusters instead. The histograms are
+ * not counted, so this is a little below what the stream will take.
+ * @return HYDStatusCode HYD_OK upon success, negative upon error.
+ */
+HYDStatusCode hyd_entropy_estimate_bits(HYDEntropyStream *stream, size_t symbol_start, int prefix_codes,
+                                        float *bits);
+
 HYDStatusCode hyd_prefix_write_stream_header(HYDEntropyStream *stream);
 HYDStatusCode hyd_prefix_write_stream_symbols(HYDEntropyStream *stream, size_t symbol_start, size_t symbol_count);
 
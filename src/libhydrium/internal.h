@@ -5,8 +5,10 @@
 #define HYDRIUM_INTERNAL_H_
 
 #include "bitwriter.h"
+#include "dct.h"
 #include "entropy.h"
 #include "libhydrium/libhydrium.h"
+#include "xyb.h"
 
 typedef struct HYDLFGroup {
     size_t tile_count_x;
@@ -20,10 +22,44 @@ typedef struct HYDLFGroup {
     size_t stride;
 } HYDLFGroup;
 
-typedef union XYBEntry {
-    float f;
-    int32_t i;
-} XYBEntry;
+/* single-pass rate control state, with sizes in bits */
+typedef struct HYDRateControl {
+    /* zero if rate control is off */
+    float budget;
+    /* estimated size of the pixels accounted for so far, and their complexity */
+    float spent;
+    float complexity;
+    size_t pixels;
+    /* the part of spent that has been measured as written */
+    float written;
+    /* bits the frame in progress is expected to write outside of its LF groups */
+    float frame_overhead;
+    /* share of the bits not yet written that is held back against estimation errors */
+    float margin;
+    /* complexity per pixel that the initial distance was picked for */
+    float prior;
+    /* distance of the quantizer, and the scale applied on top of every HfMul */
+    float distance;
+    float scale;
+    /* effective distance at which the strip costs of the LF group were sampled */
+    float sample_distance;
+    /* HF bits per unit of luma cost, and LF bits per unit of sampled LF cost */
+    float hf_ratio;
+    float lf_ratio;
+    float hf_sum;
+    float luma_sum;
+    float strip_luma;
+    float lf_sum;
+    float lf_cost_sum;
+    /* HF bits per unit of estimate_varblock_bits */
+    float calibration;
+    /* the LF group in progress, and what it was estimated to take */
+    size_t group_pixels;
+    float group_hf;
+    float group_hf_estimate;
+    float group_lf;
+    float group_lf_cost;
+} HYDRateControl;
 
 /* opaque structure */
 struct HYDEncoder {
@@ -31,7 +67,37 @@ struct HYDEncoder {
     HYDImageMetadata metadata;
     HYDEntropyStream hf_stream;
 
-    XYBEntry *xyb;
+    /* planar X, Y, and B channels, which point into xyb_buffer */
+    XYBEntry *xyb[3];
+    XYBEntry *xyb_buffer;
+    HYDXYBKernel xyb_kernel;
+    HYDDCTQuantKernel dct_kernel;
+    HYDDCTQuantLargeKernel dct_large_kernel;
+    /* linear-light value of every uint8_t and uint16_t sample */
+    float linear_lut8[256];
+    float *linear_lut16;
+
+    /* quantization parameters, derived from the distance */
+    float hf_weights[3][64];
+    /*
+     * DCT16, DCT32, DCT16X8 and DCT32X16 weights, indexed like the transposed coefficients,
+     * the last two shared with DCT8X16 and DCT16X32
+     */
+    float hf_weights16[3][256];
+    float hf_weights32[3][1024];
+    float hf_weights16x8[3][128];
+    float hf_weights32x16[3][512];
+    /* largest coded weight of each table above, for the all-zero block test */
+    float hf_weight_max[3];
+    float hf_weight_max16[3];
+    float hf_weight_max32[3];
+    float hf_weight_max16x8[3];
+    float hf_weight_max32x16[3];
+    float lf_scale[3];
+    uint32_t global_scale;
+    uint32_t quant_lf;
+    uint32_t hf_mult;
+    HYDRateControl rc;
 
     int one_frame;
     int last_tile;
@@ -58,6 +124,14 @@ struct HYDEncoder {
     size_t *section_endpos;
     size_t section_count;
     size_t *hf_stream_barrier;
+    /*
+     * With fixed histograms in one frame, the HF groups are coded as they come, ahead of
+     * the HF global section, and hf_group_end holds where each one ends in hf_writer.
+     */
+    HYDBitWriter hf_writer;
+    size_t *hf_group_end;
+    /* if set, the HF tokens of each cluster are counted into it, to train the fixed histograms */
+    uint64_t (*hf_token_counts)[64];
 
     size_t groups_encoded;
 
@@ -65,5 +139,7 @@ struct HYDEncoder {
 };
 
 HYDStatusCode hyd_populate_lf_group(HYDEncoder *encoder, HYDLFGroup **lf_group, uint32_t tile_x, uint32_t tile_y);
+void hyd_init_quantizer(HYDEncoder *encoder, float distance);
+float hyd_init_rate_control(HYDEncoder *encoder);
 
 #endif /* HYDRIUM_INTERNAL_H_ */
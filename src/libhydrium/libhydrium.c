@@ -46,6 +46,10 @@ HYDRIUM_EXPORT HYDEncoder *hyd_encoder_new(const HYDAllocator *allocator) {
         ret->allocator.free_func = &free_default;
     }
 
+    ret->xyb_kernel = hyd_xyb_select_kernel();
+    ret->dct_kernel = hyd_dct_select_kernel();
+    ret->dct_large_kernel = hyd_dct_select_large_kernel();
+
     return ret;
 }
 
@@ -55,8 +59,11 @@ HYDRIUM_EXPORT HYDStatusCode hyd_encoder_destroy(HYDEncoder *encoder) {
     hyd_entropy_stream_destroy(&encoder->hf_stream);
     hyd_free(&encoder->allocator, encoder->section_endpos);
     hyd_free(&encoder->allocator, encoder->hf_stream_barrier);
+    hyd_free(&encoder->allocator, encoder->hf_group_end);
+    hyd_free(&encoder->allocator, encoder->hf_writer.buffer);
     hyd_free(&encoder->allocator, encoder->working_writer.buffer);
-    hyd_free(&encoder->allocator, encoder->xyb);
+    hyd_free(&encoder->allocator, encoder->xyb_buffer);
+    hyd_free(&encoder->allocator, encoder->linear_lut16);
     hyd_free(&encoder->allocator, encoder->lf_group);
     hyd_free(&encoder->allocator, encoder->lf_group_perm);
     hyd_free(&encoder->allocator, encoder);
@@ -82,8 +89,23 @@ HYDRIUM_EXPORT HYDStatusCode hyd_set_metadata(HYDEncoder *encoder, const HYDImag
         return HYD_API_ERROR;
     }
 
+    if (!metadata->target_size && metadata->distance != 0.0f
+            && !(metadata->distance >= 0.1f && metadata->distance <= 25.0f)) {
+        encoder->error = "distance must be between 0.1 and 25, or 0 for the default";
+        return HYD_API_ERROR;
+    }
+
+    if (metadata->lz77_window > 1 << 20) {
+        encoder->error = "lz77_window must be at most 1 << 20, or 0 for the default";
+        return HYD_API_ERROR;
+    }
+
     encoder->metadata = *metadata;
 
+    hyd_xyb_fill_linear_lut(encoder->linear_lut8, UINT8_MAX, !metadata->linear_light);
+    /* rebuilt on demand by the first 16-bit tile */
+    hyd_freep(&encoder->allocator, &encoder->linear_lut16);
+
     if (width64 > (1 << 20) || height64 > (1 << 20) || width64 * height64 > (1 << 28))
         encoder->level10 = 1;
 
@@ -97,6 +119,7 @@ HYDRIUM_EXPORT HYDStatusCode hyd_set_metadata(HYDEncoder *encoder, const HYDImag
     }
 
     encoder->one_frame = metadata->tile_size_shift_x < 0 || metadata->tile_size_shift_y < 0;
+    hyd_init_quantizer(encoder, hyd_init_rate_control(encoder));
     encoder->lf_group_count_x = (metadata->width + 2047) >> 11;
     encoder->lf_group_count_y = (metadata->height + 2047) >> 11;
     encoder->lf_groups_per_frame = encoder->one_frame ? encoder->lf_group_count_x * encoder->lf_group_count_y : 1;
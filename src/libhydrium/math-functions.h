@@ -60,6 +60,35 @@ static inline int hyd_isfinite(const float x) {
     return (z.i & 0x7f800000) != 0x7f800000;
 }
 
+/*
+ * Approximations for table setup and rate estimates, as the library does not link libm.
+ * Each is good to about 1e-6 over the ranges used.
+ */
+static inline float hyd_approx_log2f(const float x) {
+    union { float f; uint32_t i; } z = { .f = x };
+    const int exponent = (int)((z.i >> 23) & 0xFF) - 127;
+    z.i = (z.i & 0x7FFFFF) | 0x3F800000;
+    /* 2 atanh(t) / ln(2) with t = (m - 1) / (m + 1) below 1/3 */
+    const float t = (z.f - 1.0f) / (z.f + 1.0f);
+    const float t2 = t * t;
+    return exponent + 2.885390082f * t *
+        (1.0f + t2 * (0.333333333f + t2 * (0.2f + t2 * (0.142857143f + t2 * 0.111111111f))));
+}
+
+static inline float hyd_approx_exp2f(const float x) {
+    int n = (int)x;
+    if (x < n)
+        n--;
+    const float f = (x - n) * 0.693147181f;
+    float term = 1.0f, sum = 1.0f;
+    for (int i = 1; i < 9; i++) {
+        term *= f / i;
+        sum += term;
+    }
+    const union { uint32_t i; float f; } z = { .i = (uint32_t)(n + 127) << 23 };
+    return sum * z.f;
+}
+
 #define hyd_abs(a) ((a) < 0 ? -(a) : (a))
 #define hyd_array_size(a) (sizeof((a))/sizeof(*(a)))
 #define hyd_max(a, b) ((a) > (b) ? (a) : (b))
@@ -0,0 +1,34 @@
+/*
+ * Compiler and CPU feature detection for the vector kernels
+ */
+#ifndef HYDRIUM_SIMD_H_
+#define HYDRIUM_SIMD_H_
+
+/*
+ * Kernels are written with GCC/Clang vector extensions rather than intrinsics,
+ * so SSE2 and NEON share the same source. Other compilers use scalar code.
+ */
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__SSE2__) || defined(__ARM_NEON))
+#define HYD_HAVE_VECTOR_EXT 1
+#else
+#define HYD_HAVE_VECTOR_EXT 0
+#endif
+
+/* AVX2 kernels are compiled with a target attribute and picked at runtime */
+#if HYD_HAVE_VECTOR_EXT && (defined(__x86_64__) || defined(__i386__))
+#define HYD_HAVE_AVX2 1
+#else
+#define HYD_HAVE_AVX2 0
+#endif
+
+#if HYD_HAVE_VECTOR_EXT
+#if defined(__clang__) || __GNUC__ >= 12
+#define hyd_shuffle8(type, a, b, i0, i1, i2, i3, i4, i5, i6, i7) \
+    __builtin_shufflevector((a), (b), i0, i1, i2, i3, i4, i5, i6, i7)
+#else
+#define hyd_shuffle8(type, a, b, i0, i1, i2, i3, i4, i5, i6, i7) \
+    __builtin_shuffle((a), (b), (type){i0, i1, i2, i3, i4, i5, i6, i7})
+#endif
+#endif /* HYD_HAVE_VECTOR_EXT */
+
+#endif /* HYDRIUM_SIMD_H_ */
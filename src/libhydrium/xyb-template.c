@@ -0,0 +1,64 @@
+/*
+ * XYB kernel template
+ *
+ * Define XYB_WIDTH, XYB_SUFFIX, and XYB_TARGET before including this file.
+ * The arithmetic here must stay in the same order as the scalar code in xyb.c,
+ * so that every kernel produces bit-identical output.
+ */
+
+#define XYB_CAT0(a, b) a ## _ ## b
+#define XYB_CAT(a, b) XYB_CAT0(a, b)
+#define XYB_FN(name) XYB_CAT(name, XYB_SUFFIX)
+
+typedef float XYB_FN(vf) __attribute__((vector_size(4 * XYB_WIDTH)));
+typedef uint32_t XYB_FN(vu) __attribute__((vector_size(4 * XYB_WIDTH)));
+typedef int32_t XYB_FN(vi) __attribute__((vector_size(4 * XYB_WIDTH)));
+
+XYB_TARGET static inline XYB_FN(vf) XYB_FN(linearize)(const XYB_FN(vf) x) {
+    const XYB_FN(vf) low = 0.07739938080495357f * x;
+    const XYB_FN(vf) high = 0.003094300919832f + x * (-0.009982599f + x * (0.72007737769f + 0.2852804880f * x));
+    const XYB_FN(vi) mask = x <= 0.0404482362771082f;
+    return (XYB_FN(vf))(((XYB_FN(vi))low & mask) | ((XYB_FN(vi))high & ~mask));
+}
+
+XYB_TARGET static inline XYB_FN(vf) XYB_FN(cbrtf)(const XYB_FN(vf) x) {
+    XYB_FN(vf) z = (XYB_FN(vf))(0x548c39cb - (XYB_FN(vu))x / 3);
+    z *= 1.5015480449f - 0.534850249f * x * z * z * z;
+    z *= 1.333333985f - 0.33333333f * x * z * z * z;
+    return 1.0f / z;
+}
+
+XYB_TARGET static void XYB_FN(xyb_kernel)(float *const xyb[3], float rgb[3][HYD_XYB_BATCH], size_t count,
+                                          int linearize) {
+    size_t i = 0;
+    for (; i + XYB_WIDTH <= count; i += XYB_WIDTH) {
+        XYB_FN(vf) r, g, b;
+        memcpy(&r, rgb[0] + i, sizeof(r));
+        memcpy(&g, rgb[1] + i, sizeof(g));
+        memcpy(&b, rgb[2] + i, sizeof(b));
+        if (linearize) {
+            r = XYB_FN(linearize)(r);
+            g = XYB_FN(linearize)(g);
+            b = XYB_FN(linearize)(b);
+        }
+        const XYB_FN(vf) lgamma = XYB_FN(cbrtf)(0.3f * r + 0.622f * g + 0.078f * b
+            + 0.0037930732552754493f) - 0.155954f;
+        const XYB_FN(vf) mgamma = XYB_FN(cbrtf)(0.23f * r + 0.692f * g + 0.078f * b
+            + 0.0037930732552754493f) - 0.155954f;
+        const XYB_FN(vf) sgamma = XYB_FN(cbrtf)(0.243423f * r + 0.204767f * g + 0.55181f * b
+            + 0.0037930732552754493f) - 0.155954f;
+        const XYB_FN(vf) x = (lgamma - mgamma) * 0.5f;
+        const XYB_FN(vf) y = (lgamma + mgamma) * 0.5f;
+        /* chroma-from-luma adds B to Y */
+        const XYB_FN(vf) s = sgamma - y;
+        memcpy(xyb[0] + i, &x, sizeof(x));
+        memcpy(xyb[1] + i, &y, sizeof(y));
+        memcpy(xyb[2] + i, &s, sizeof(s));
+    }
+    for (; i < count; i++)
+        xyb_pixel(xyb, i, rgb[0][i], rgb[1][i], rgb[2][i], linearize);
+}
+
+#undef XYB_CAT0
+#undef XYB_CAT
+#undef XYB_FN
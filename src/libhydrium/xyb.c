@@ -0,0 +1,86 @@
+/*
+ * Linear RGB to XYB conversion kernels
+ */
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "simd.h"
+#include "xyb.h"
+
+static inline float linearize(const float x) {
+    if (x <= 0.0404482362771082f)
+        return 0.07739938080495357f * x;
+    return 0.003094300919832f + x * (-0.009982599f + x * (0.72007737769f + 0.2852804880f * x));
+}
+
+static inline float hyd_cbrtf(const float x) {
+    union { float f; uint32_t i; } z = { .f = x };
+    z.i = 0x548c39cb - z.i / 3;
+    z.f *= 1.5015480449f - 0.534850249f * x * z.f * z.f * z.f;
+    z.f *= 1.333333985f - 0.33333333f * x * z.f * z.f * z.f;
+    return 1.0f / z.f;
+}
+
+static inline void xyb_pixel(float *const xyb[3], const size_t i, float r, float g, float b,
+                             const int do_linearize) {
+    if (do_linearize) {
+        r = linearize(r);
+        g = linearize(g);
+        b = linearize(b);
+    }
+    const float lgamma = hyd_cbrtf(0.3f * r + 0.622f * g + 0.078f * b
+        + 0.0037930732552754493f) - 0.155954f;
+    const float mgamma = hyd_cbrtf(0.23f * r + 0.692f * g + 0.078f * b
+        + 0.0037930732552754493f) - 0.155954f;
+    const float sgamma = hyd_cbrtf(0.243423f * r + 0.204767f * g + 0.55181f * b
+        + 0.0037930732552754493f) - 0.155954f;
+    xyb[0][i] = (lgamma - mgamma) * 0.5f;
+    const float y = xyb[1][i] = (lgamma + mgamma) * 0.5f;
+    /* chroma-from-luma adds B to Y */
+    xyb[2][i] = sgamma - y;
+}
+
+static void xyb_kernel_scalar(float *const xyb[3], float rgb[3][HYD_XYB_BATCH], size_t count, int linearize) {
+    for (size_t i = 0; i < count; i++)
+        xyb_pixel(xyb, i, rgb[0][i], rgb[1][i], rgb[2][i], linearize);
+}
+
+#if HYD_HAVE_VECTOR_EXT
+/* SSE2 and NEON are baseline wherever they are detected, so this needs no dispatch */
+#define XYB_WIDTH 4
+#define XYB_SUFFIX x4
+#define XYB_TARGET
+#include "xyb-template.c"
+#undef XYB_WIDTH
+#undef XYB_SUFFIX
+#undef XYB_TARGET
+#endif
+
+#if HYD_HAVE_AVX2
+#define XYB_WIDTH 8
+#define XYB_SUFFIX avx2
+#define XYB_TARGET __attribute__((target("avx2")))
+#include "xyb-template.c"
+#undef XYB_WIDTH
+#undef XYB_SUFFIX
+#undef XYB_TARGET
+#endif
+
+void hyd_xyb_fill_linear_lut(float *lut, uint32_t max_value, int do_linearize) {
+    const float scale = 1.0f / max_value;
+    for (uint32_t i = 0; i <= max_value; i++)
+        lut[i] = do_linearize ? linearize(i * scale) : i * scale;
+}
+
+HYDXYBKernel hyd_xyb_select_kernel(void) {
+#if HYD_HAVE_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return &xyb_kernel_avx2;
+#endif
+#if HYD_HAVE_VECTOR_EXT
+    return &xyb_kernel_x4;
+#endif
+    return &xyb_kernel_scalar;
+}
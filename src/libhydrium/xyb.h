@@ -0,0 +1,33 @@
+#ifndef HYDRIUM_XYB_H_
+#define HYDRIUM_XYB_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* number of pixels handed to an XYB kernel at once */
+#define HYD_XYB_BATCH 64
+
+typedef union XYBEntry {
+    float f;
+    int32_t i;
+} XYBEntry;
+
+/*
+ * Converts count pixels of planar RGB into planar XYB.
+ * If linearize is nonzero, the RGB input is treated as sRGB, otherwise as linear light.
+ */
+typedef void (*HYDXYBKernel)(float *const xyb[3], float rgb[3][HYD_XYB_BATCH], size_t count, int linearize);
+
+/**
+ * @brief Fill lut[0] through lut[max_value] with the linear-light value of each integer sample.
+ * @param linearize nonzero if the samples are sRGB, zero if they are already linear light.
+ */
+void hyd_xyb_fill_linear_lut(float *lut, uint32_t max_value, int linearize);
+
+/**
+ * @brief Pick the fastest XYB kernel supported by the running CPU.
+ * @return HYDXYBKernel a kernel that is bit-exact with the portable scalar one.
+ */
+HYDXYBKernel hyd_xyb_select_kernel(void);
+
+#endif /* HYDRIUM_XYB_H_ */
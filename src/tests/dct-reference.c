@@ -0,0 +1,351 @@
+/*
+ * Test for the 8x8 DCT kernels
+ *
+ * Keeps the matrix-multiply DCT that the factored transform replaced, as the reference,
+ * and checks every kernel the CPU supports against it on random blocks. The kernels must
+ * match the reference within TOLERANCE, which is above the error of the 6-digit constants
+ * of cosine_lut, and must match the portable scalar kernel exactly. For the larger transforms,
+ * the 16-point and 32-point DCTs are checked against the direct DCT-II, the LF values against
+ * the derivation of the lowest frequencies the decoder applies to them, and the coefficient
+ * walk against the natural order of the spec, on every shape the encoder uses. Their vector
+ * kernels must match the scalar one exactly.
+ * The kernels are static, so their source is included directly.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "dct.c"
+
+#define NUM_BLOCKS 100000
+#define NUM_LARGE_BLOCKS 2000
+#define TOLERANCE 1e-6
+/* the constants of the larger transforms have 9 digits, so they stay within the same tolerance */
+#define LARGE_TOLERANCE 1e-6
+#define PI 3.14159265358979323846
+#define SQRT2 1.41421356237309504880
+/* quantizing with unit weights at this multiplier keeps the coefficients to within 2^-24 */
+#define MULT 16777216.0f
+
+typedef struct KernelEntry {
+    const char *name;
+    HYDDCTQuantKernel kernel;
+} KernelEntry;
+
+typedef struct LargeKernelEntry {
+    const char *name;
+    HYDDCTQuantLargeKernel kernel;
+} LargeKernelEntry;
+
+static const float cosine_lut[7][8] = {
+    {0.17338, 0.146984, 0.0982119, 0.0344874, -0.0344874, -0.0982119, -0.146984, -0.17338},
+    {0.16332, 0.0676495, -0.0676495, -0.16332, -0.16332, -0.0676495, 0.0676495, 0.16332},
+    {0.146984, -0.0344874, -0.17338, -0.0982119, 0.0982119, 0.17338, 0.0344874, -0.146984},
+    {0.125, -0.125, -0.125, 0.125, 0.125, -0.125, -0.125, 0.125},
+    {0.0982119, -0.17338, 0.0344874, 0.146984, -0.146984, -0.0344874, 0.17338, -0.0982119},
+    {0.0676495, -0.16332, 0.16332, -0.0676495, -0.0676495, 0.16332, -0.16332, 0.0676495},
+    {0.0344874, -0.0982119, 0.146984, -0.17338, 0.17338, -0.146984, 0.0982119, -0.0344874},
+};
+
+static uint32_t rng_state = 0x2545F491;
+
+static uint32_t next_random(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+/*
+ * The former forward_dct on a single block, writing the coefficients in place of the samples,
+ * so that the coefficient at natural position k ends up at out[natural_index[k]].
+ */
+static void reference_dct(float out[64], const XYBEntry *block, const ptrdiff_t stride) {
+    float scratchblock[2][8][8];
+    memset(scratchblock, 0, sizeof(scratchblock));
+    for (size_t y = 0; y < 8; y++) {
+        const size_t posy = y * stride;
+        scratchblock[0][y][0] = block[posy].f;
+        for (size_t x = 1; x < 8; x++)
+            scratchblock[0][y][0] += block[posy + x].f;
+        scratchblock[0][y][0] *= 0.125f;
+        for (size_t k = 1; k < 8; k++) {
+            for (size_t n = 0; n < 8; n++)
+                scratchblock[0][y][k] += block[posy + n].f * cosine_lut[k - 1][n];
+        }
+    }
+    for (size_t x = 0; x < 8; x++) {
+        scratchblock[1][0][x] = scratchblock[0][0][x];
+        for (size_t y = 1; y < 8; y++)
+            scratchblock[1][0][x] += scratchblock[0][y][x];
+        scratchblock[1][0][x] *= 0.125f;
+        for (size_t k = 1; k < 8; k++) {
+            for (size_t n = 0; n < 8; n++)
+                scratchblock[1][k][x] += scratchblock[0][n][x] * cosine_lut[k - 1][n];
+        }
+    }
+    for (size_t y = 0; y < 8; y++) {
+        for (size_t x = 0; x < 8; x++)
+            out[y * 8 + x] = scratchblock[1][x][y];
+    }
+}
+
+/* cosine by its Taylor series, which is exact to double precision over [-pi, pi], so that libm is not needed */
+static double cosine(double x) {
+    while (x > PI)
+        x -= 2.0 * PI;
+    while (x < -PI)
+        x += 2.0 * PI;
+    double term = 1.0, sum = 1.0;
+    for (int i = 1; i < 30; i++) {
+        term *= -x * x / ((2 * i - 1) * (2 * i));
+        sum += term;
+    }
+    return sum;
+}
+
+/* coefficient k of the n-point DCT-II of in, normalized so that the DC coefficient is the mean */
+static double reference_dct_coeff(const double *in, const size_t stride, const size_t n, const size_t k) {
+    double sum = 0.0;
+    for (size_t m = 0; m < n; m++)
+        sum += in[m * stride] * cosine(PI * (2 * m + 1) * k / (2 * n));
+    return sum * (k ? SQRT2 : 1.0) / n;
+}
+
+/* the unscaled fdct16 or fdct32 against the direct DCT-II, returning the largest error after scaling */
+static double check_dct_n(const size_t n) {
+    float in[32], out[32];
+    double ref_in[32], max_error = 0.0;
+    for (size_t b = 0; b < NUM_LARGE_BLOCKS; b++) {
+        for (size_t i = 0; i < n; i++)
+            ref_in[i] = in[i] = (next_random() >> 8) * (1.0f / (1 << 24));
+        fdct_n(out, in, n);
+        for (size_t k = 0; k < n; k++) {
+            const double diff = out[k] / (double)n - reference_dct_coeff(ref_in, 1, n, k);
+            const double error = diff < 0.0 ? -diff : diff;
+            if (error > max_error)
+                max_error = error;
+        }
+    }
+    return max_error;
+}
+
+/* the ratio the decoder applies to frequency k of an n-sample varblock derived from its LF values */
+static double resample_scale(const size_t k, const size_t n) {
+    const double a = PI * k / (2 * n);
+    return cosine(a) * cosine(2 * a) * cosine(4 * a);
+}
+
+/*
+ * Derives the lowest frequencies of random transposed rows-by-cols blocks from the LF values
+ * that store_lf_values picks for them, the way the decoder does: the DCT of the LF values,
+ * scaled by resample_scale along each side. Returns the largest error against the block.
+ */
+static double check_lf_values(const size_t rows, const size_t cols) {
+    const size_t side_v = rows >> 3;
+    const size_t side_h = cols >> 3;
+    float block[32 * 32];
+    XYBEntry coeffs[16];
+    double lf[16], max_error = 0.0;
+    for (size_t b = 0; b < NUM_LARGE_BLOCKS; b++) {
+        for (size_t i = 0; i < rows * cols; i++)
+            block[i] = (next_random() >> 8) * (1.0f / (1 << 24));
+        store_lf_values(coeffs, block, rows, cols);
+        for (size_t i = 0; i < side_v * side_h; i++)
+            lf[i] = coeffs[i].f;
+        for (size_t fv = 0; fv < side_v; fv++) {
+            for (size_t fh = 0; fh < side_h; fh++) {
+                double columns[4];
+                for (size_t bx = 0; bx < side_h; bx++)
+                    columns[bx] = reference_dct_coeff(lf + bx, side_h, side_v, fv);
+                const double llf = reference_dct_coeff(columns, 1, side_h, fh) *
+                    resample_scale(fv, rows) * resample_scale(fh, cols);
+                const double diff = llf - block[fh * rows + fv];
+                const double error = diff < 0.0 ? -diff : diff;
+                if (error > max_error)
+                    max_error = error;
+            }
+        }
+    }
+    return max_error;
+}
+
+/*
+ * The natural order of the spec for a varblock of cy by cx blocks with cx >= cy, as positions
+ * y * 8 cx + x of its coefficients with y along the shorter side, written from natural index cy * cx
+ * on. Its anti-diagonals run over a square of 8 cx and keep one line in every cx / cy.
+ */
+static void spec_natural_order(size_t *order, const size_t cy, const size_t cx) {
+    const size_t n = 8 * cx;
+    const size_t ratio = cx / cy;
+    size_t k = cy * cx;
+    /* the upper-left half of the square, with the lowest frequencies already in front */
+    for (size_t i = 0; i < n; i++) {
+        for (size_t j = 0; j <= i; j++) {
+            const size_t x = i & 1 ? i - j : j;
+            const size_t y = i & 1 ? j : i - j;
+            if (y % ratio || (x < cx && y / ratio < cy))
+                continue;
+            order[k++] = y / ratio * n + x;
+        }
+    }
+    /* the lower-right half */
+    for (size_t i = n - 1; i > 0; i--) {
+        for (size_t j = 0; j < i; j++) {
+            const size_t x = i & 1 ? n - i + j : n - 1 - j;
+            const size_t y = i & 1 ? n - 1 - j : n - i + j;
+            if (y % ratio)
+                continue;
+            order[k++] = y / ratio * n + x;
+        }
+    }
+}
+
+/* checks that quantize_large writes the coefficients of a transposed rows-by-cols block in spec order */
+static int check_natural_order(const size_t rows, const size_t cols) {
+    static float block[32 * 32], weights[32 * 32];
+    static XYBEntry coeffs[32 * 32];
+    static size_t order[32 * 32];
+    const size_t covered = (rows >> 3) * (cols >> 3);
+    size_t last;
+    /* every coefficient quantizes to its own position plus 2, outside the deadzone */
+    for (size_t i = 0; i < rows * cols; i++) {
+        block[i] = (float)(i + 2);
+        weights[i] = 1.0f;
+    }
+    quantize_large(coeffs, block, rows, cols, weights, 1.0f, NULL, NULL, &last);
+    spec_natural_order(order, cols >> 3, rows >> 3);
+    for (size_t k = covered; k < rows * cols; k++) {
+        /* the spec has the horizontal frequency h in y and the vertical one v in x, so h * rows + v */
+        if ((size_t)coeffs[k].i != order[k] + 2) {
+            fprintf(stderr, "natural order of %zux%zu differs from the spec at %zu\n", rows, cols, k);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static size_t list_kernels(KernelEntry *kernels) {
+    size_t count = 0;
+    kernels[count++] = (KernelEntry){"scalar", &dct_kernel_scalar};
+#if HYD_HAVE_VECTOR_EXT
+    kernels[count++] = (KernelEntry){"x8", &dct_kernel_x8};
+#endif
+#if HYD_HAVE_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        kernels[count++] = (KernelEntry){"avx2", &dct_kernel_avx2};
+#endif
+    return count;
+}
+
+static size_t list_large_kernels(LargeKernelEntry *kernels) {
+    size_t count = 0;
+    kernels[count++] = (LargeKernelEntry){"scalar", &dct_large_kernel_scalar};
+#if HYD_HAVE_VECTOR_EXT
+    kernels[count++] = (LargeKernelEntry){"x8", &dct_large_kernel_x8};
+#endif
+#if HYD_HAVE_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        kernels[count++] = (LargeKernelEntry){"avx2", &dct_large_kernel_avx2};
+#endif
+    return count;
+}
+
+/* every other block is quantized to nothing, which takes the shortcut for empty varblocks */
+static int run_large_kernels(void) {
+    static const size_t shapes[4][2] = {{16, 8}, {16, 16}, {32, 16}, {32, 32}};
+    const ptrdiff_t stride = 40;
+    static XYBEntry block[32 * 40];
+    XYBEntry expected[1024], actual[1024];
+    float weights[1024];
+    LargeKernelEntry kernels[3];
+    const size_t num_kernels = list_large_kernels(kernels);
+    size_t expected_last, actual_last;
+
+    for (size_t k = 0; k < 1024; k++)
+        weights[k] = 1.0f;
+
+    for (size_t s = 0; s < 4; s++) {
+        const size_t rows = shapes[s][0], cols = shapes[s][1];
+        for (size_t b = 0; b < NUM_LARGE_BLOCKS; b++) {
+            const float mult = b & 1 ? 1.0f : MULT;
+            for (size_t i = 0; i < 32 * 40; i++)
+                block[i].f = (next_random() >> 8) * (1.0f / (1 << 24));
+            dct_large_kernel_scalar(expected, block, stride, rows, cols, weights, 1.0f, mult, NULL, NULL,
+                &expected_last);
+            for (size_t k = 1; k < num_kernels; k++) {
+                kernels[k].kernel(actual, block, stride, rows, cols, weights, 1.0f, mult, NULL, NULL, &actual_last);
+                if (memcmp(expected, actual, rows * cols * sizeof(XYBEntry)) || expected_last != actual_last) {
+                    fprintf(stderr, "%s large kernel differs from scalar at %zux%zu block %zu\n", kernels[k].name,
+                        rows, cols, b);
+                    return 1;
+                }
+            }
+        }
+    }
+
+    for (size_t k = 0; k < num_kernels; k++)
+        fprintf(stderr, "%s%s", k ? ", " : "large kernels tested: ", kernels[k].name);
+    fprintf(stderr, "\n");
+
+    double max_error = 0.0;
+    int ret = 0;
+    for (size_t n = 16; n <= 32; n <<= 1) {
+        const double error = check_dct_n(n);
+        max_error = error > max_error ? error : max_error;
+    }
+    for (size_t s = 0; s < 4; s++) {
+        const double error = check_lf_values(shapes[s][0], shapes[s][1]);
+        max_error = error > max_error ? error : max_error;
+        ret |= check_natural_order(shapes[s][0], shapes[s][1]);
+    }
+    fprintf(stderr, "largest error of the large transforms against the reference: %g, tolerance %g\n", max_error,
+        LARGE_TOLERANCE);
+
+    return ret || max_error > LARGE_TOLERANCE;
+}
+
+int main(void) {
+    /* a block within a wider row, as the kernels see it in the encoder */
+    const ptrdiff_t stride = 24;
+    XYBEntry block[8 * 24];
+    XYBEntry expected[64], actual[64];
+    float weights[64], reference[64];
+    KernelEntry kernels[3];
+    const size_t num_kernels = list_kernels(kernels);
+    double max_error = 0.0;
+    size_t last;
+
+    for (size_t k = 0; k < 64; k++)
+        weights[k] = 1.0f;
+
+    for (size_t b = 0; b < NUM_BLOCKS; b++) {
+        for (size_t i = 0; i < 8 * 24; i++)
+            block[i].f = (next_random() >> 8) * (1.0f / (1 << 24));
+        reference_dct(reference, block, stride);
+        dct_kernel_scalar(expected, block, stride, weights, 1.0f, MULT, NULL, NULL, &last);
+        for (size_t k = 1; k < num_kernels; k++) {
+            kernels[k].kernel(actual, block, stride, weights, 1.0f, MULT, NULL, NULL, &last);
+            if (memcmp(expected, actual, sizeof(actual))) {
+                fprintf(stderr, "%s kernel differs from scalar at block %zu\n", kernels[k].name, b);
+                return 1;
+            }
+        }
+        for (size_t k = 0; k < 64; k++) {
+            const double coeff = k ? expected[k].i / (double)MULT : expected[k].f;
+            const double diff = coeff - reference[natural_index[k]];
+            const double error = diff < 0.0 ? -diff : diff;
+            if (error > max_error)
+                max_error = error;
+        }
+    }
+
+    for (size_t k = 0; k < num_kernels; k++)
+        fprintf(stderr, "%s%s", k ? ", " : "kernels tested: ", kernels[k].name);
+    fprintf(stderr, "\nlargest error against the reference: %g, tolerance %g\n", max_error, TOLERANCE);
+
+    return max_error > TOLERANCE || run_large_kernels();
+}
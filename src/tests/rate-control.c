@@ -0,0 +1,139 @@
+/*
+ * Test for the rate control
+ *
+ * Encodes a few synthetic images, a sawtooth, a pattern that is hard to predict, and a
+ * photo-like mix of gradients, an edge and noise, at several target sizes, as one Frame and
+ * as 256x256 tiles, and checks that no file comes out larger than its target size, which
+ * libhydrium treats as a ceiling.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libhydrium/libhydrium.h"
+
+#define WIDTH 1000
+#define HEIGHT 700
+#define OUTPUT_SIZE (1 << 16)
+
+static uint32_t rng_state = 0x2545F491;
+
+static uint32_t next_random(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+static uint8_t sample(const int kind, const size_t x, const size_t y, const int c) {
+    float v;
+    if (kind == 0) {
+        v = ((x * (c + 1) + y * 2) % 256) / 255.0f;
+    } else if (kind == 1) {
+        v = 0.5f + 0.4f * ((x * x + y * y * (c + 1)) % 97 / 97.0f - 0.5f) + ((x / 40 + y / 40) % 3) * 0.05f;
+    } else {
+        const float fx = (float)x / WIDTH, fy = (float)y / HEIGHT;
+        const long dx = (long)x - WIDTH / 3, dy = (long)y - HEIGHT / 2;
+        v = 0.3f + 0.4f * fx * (c == 0) + 0.3f * fy * (c == 1) + 0.1f * (c == 2) * (fx + fy);
+        if (dx * dx + dy * dy < (WIDTH / 6) * (WIDTH / 6))
+            v = 0.8f - 0.3f * c * fy;
+        v += ((int)(next_random() % 17) - 8) / 800.0f;
+        v = v < 0.0f ? 0.0f : v > 1.0f ? 1.0f : v;
+    }
+    return (uint8_t)(v * 255.0f + 0.5f);
+}
+
+/* Encode the image with the given target size, and return the size of the file, or 0 upon failure. */
+static size_t encode(const uint8_t *image, const int tile_size_shift, const size_t target_size, uint8_t *output) {
+    size_t total = 0;
+    HYDEncoder *encoder = hyd_encoder_new(NULL);
+    if (!encoder)
+        return 0;
+    HYDImageMetadata metadata;
+    memset(&metadata, 0, sizeof(metadata));
+    metadata.width = WIDTH;
+    metadata.height = HEIGHT;
+    metadata.tile_size_shift_x = metadata.tile_size_shift_y = tile_size_shift;
+    metadata.target_size = target_size;
+    HYDStatusCode ret = hyd_set_metadata(encoder, &metadata);
+    if (ret < HYD_ERROR_START)
+        goto end;
+    ret = hyd_provide_output_buffer(encoder, output, OUTPUT_SIZE);
+    if (ret < HYD_ERROR_START)
+        goto end;
+    const size_t tile_size = (size_t)256 << (tile_size_shift < 0 ? 3 : tile_size_shift);
+    for (size_t ty = 0; ty < (HEIGHT + tile_size - 1) / tile_size; ty++) {
+        for (size_t tx = 0; tx < (WIDTH + tile_size - 1) / tile_size; tx++) {
+            const uint8_t *tile = image + (ty * tile_size * WIDTH + tx * tile_size) * 3;
+            const void *const rgb[3] = {tile, tile + 1, tile + 2};
+            ret = hyd_send_tile(encoder, rgb, tx, ty, WIDTH * 3, 3, -1, HYD_UINT8);
+            if (ret < HYD_ERROR_START)
+                goto end;
+            do {
+                ret = hyd_flush(encoder);
+                size_t written;
+                HYDStatusCode ret2 = hyd_release_output_buffer(encoder, &written);
+                if (ret2 < HYD_ERROR_START) {
+                    ret = ret2;
+                    goto end;
+                }
+                total += written;
+                ret2 = hyd_provide_output_buffer(encoder, output, OUTPUT_SIZE);
+                if (ret2 < HYD_ERROR_START) {
+                    ret = ret2;
+                    goto end;
+                }
+            } while (ret == HYD_NEED_MORE_OUTPUT);
+            if (ret != HYD_OK)
+                goto end;
+        }
+    }
+
+end:
+    if (ret != HYD_OK) {
+        const char *message = hyd_error_message_get(encoder);
+        fprintf(stderr, "encoding failed with status %d%s%s\n", ret, message ? ": " : "", message ? message : "");
+        total = 0;
+    }
+    hyd_encoder_destroy(encoder);
+    return total;
+}
+
+int main(void) {
+    static const size_t target_sizes[] = {20000, 60000, 150000};
+    static const int tile_size_shifts[] = {-1, 0};
+    int ret = 1;
+    uint8_t *image = malloc(WIDTH * HEIGHT * 3);
+    uint8_t *output = malloc(OUTPUT_SIZE);
+    if (!image || !output)
+        goto end;
+
+    for (int kind = 0; kind < 3; kind++) {
+        for (size_t y = 0; y < HEIGHT; y++) {
+            for (size_t x = 0; x < WIDTH; x++) {
+                for (int c = 0; c < 3; c++)
+                    image[(y * WIDTH + x) * 3 + c] = sample(kind, x, y, c);
+            }
+        }
+        for (size_t s = 0; s < sizeof(tile_size_shifts) / sizeof(*tile_size_shifts); s++) {
+            for (size_t t = 0; t < sizeof(target_sizes) / sizeof(*target_sizes); t++) {
+                const size_t size = encode(image, tile_size_shifts[s], target_sizes[t], output);
+                if (!size)
+                    goto end;
+                if (size > target_sizes[t]) {
+                    fprintf(stderr, "image %d, tile size shift %d: %zu bytes over a target of %zu\n",
+                        kind, tile_size_shifts[s], size, target_sizes[t]);
+                    goto end;
+                }
+            }
+        }
+    }
+    ret = 0;
+
+end:
+    free(image);
+    free(output);
+    return ret;
+}
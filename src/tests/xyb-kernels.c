@@ -0,0 +1,108 @@
+/*
+ * Test for the XYB kernels
+ *
+ * Runs every kernel the CPU supports on random batches of each sample format,
+ * prepared as populate_xyb_buffer prepares them, and checks that the output is
+ * bit-identical to the portable scalar kernel.
+ * The kernels are static, so their source is included directly.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "xyb.c"
+
+#define NUM_BATCHES 4096
+
+typedef struct KernelEntry {
+    const char *name;
+    HYDXYBKernel kernel;
+} KernelEntry;
+
+static uint32_t rng_state = 0x2545F491;
+
+static uint32_t next_random(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+static size_t list_kernels(KernelEntry *kernels) {
+    size_t count = 0;
+    kernels[count++] = (KernelEntry){"scalar", &xyb_kernel_scalar};
+#if HYD_HAVE_VECTOR_EXT
+    kernels[count++] = (KernelEntry){"x4", &xyb_kernel_x4};
+#endif
+#if HYD_HAVE_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        kernels[count++] = (KernelEntry){"avx2", &xyb_kernel_avx2};
+#endif
+    return count;
+}
+
+/* fills a batch like the row loaders do, the integer formats through their lookup tables */
+static void fill_batch(float rgb[3][HYD_XYB_BATCH], const char *format, const float *lut8, const float *lut16) {
+    for (int c = 0; c < 3; c++) {
+        for (size_t x = 0; x < HYD_XYB_BATCH; x++) {
+            const uint32_t r = next_random();
+            if (!strcmp(format, "uint8"))
+                rgb[c][x] = lut8[r & 0xFF];
+            else if (!strcmp(format, "uint16"))
+                rgb[c][x] = lut16[r & 0xFFFF];
+            else
+                rgb[c][x] = (r >> 8) * (1.0f / (1 << 24));
+        }
+    }
+}
+
+static int run_format(const KernelEntry *kernels, size_t num_kernels, const char *format, int linearize,
+                      const float *lut8, const float *lut16) {
+    float rgb[3][HYD_XYB_BATCH], input[3][HYD_XYB_BATCH];
+    float expected[3][HYD_XYB_BATCH], actual[3][HYD_XYB_BATCH];
+    float *const expected_planes[3] = {expected[0], expected[1], expected[2]};
+    float *const actual_planes[3] = {actual[0], actual[1], actual[2]};
+    for (size_t batch = 0; batch < NUM_BATCHES; batch++) {
+        fill_batch(rgb, format, lut8, lut16);
+        /* the batches at the end of a row are short, so every count is covered */
+        const size_t count = batch % 8 ? HYD_XYB_BATCH : 1 + next_random() % HYD_XYB_BATCH;
+        memcpy(input, rgb, sizeof(rgb));
+        memset(expected, 0, sizeof(expected));
+        xyb_kernel_scalar(expected_planes, input, count, linearize);
+        for (size_t k = 1; k < num_kernels; k++) {
+            memcpy(input, rgb, sizeof(rgb));
+            memset(actual, 0, sizeof(actual));
+            kernels[k].kernel(actual_planes, input, count, linearize);
+            if (memcmp(expected, actual, sizeof(actual))) {
+                fprintf(stderr, "%s kernel differs from scalar: %s, linearize %d, batch %zu, count %zu\n",
+                    kernels[k].name, format, linearize, batch, count);
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+int main(void) {
+    static float lut8[256], lut16[65536];
+    KernelEntry kernels[3];
+    const size_t num_kernels = list_kernels(kernels);
+    int ret = 0;
+
+    for (int linearize = 0; linearize < 2; linearize++) {
+        hyd_xyb_fill_linear_lut(lut8, 255, linearize);
+        hyd_xyb_fill_linear_lut(lut16, 65535, linearize);
+        /* integer samples are linearized by the lookup tables, and floats by the kernel */
+        ret |= run_format(kernels, num_kernels, "uint8", 0, lut8, lut16);
+        ret |= run_format(kernels, num_kernels, "uint16", 0, lut8, lut16);
+        ret |= run_format(kernels, num_kernels, "float32", linearize, lut8, lut16);
+    }
+
+    for (size_t k = 0; k < num_kernels; k++)
+        fprintf(stderr, "%s%s", k ? ", " : "kernels tested: ", kernels[k].name);
+    fprintf(stderr, "\n");
+
+    return ret;
+}
@@ -0,0 +1,173 @@
+/*
+ * Training tool for the fixed HF histograms
+ *
+ * Encodes each input at a few distances, counts the HF tokens of every cluster at each,
+ * and prints the normalized histograms as the source of src/libhydrium/hf-histograms.c.
+ * It reaches into the encoder, so it is built from the library sources.
+ * Inputs are binary PPM files with 8-bit samples.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libhydrium/libhydrium.h"
+#include "internal.h"
+
+static const float distances[] = { 0.5f, 1.0f, 2.0f, 4.0f };
+
+static uint64_t counts[4][45][64];
+
+static int read_token(FILE *fin, size_t *value) {
+    int c;
+    do {
+        c = fgetc(fin);
+        if (c == '#') {
+            while (c != '\n' && c != EOF)
+                c = fgetc(fin);
+        }
+    } while (c == ' ' || c == '\t' || c == '\r' || c == '\n');
+    if (c < '0' || c > '9')
+        return -1;
+    *value = 0;
+    while (c >= '0' && c <= '9') {
+        *value = *value * 10 + (c - '0');
+        c = fgetc(fin);
+    }
+    return 0;
+}
+
+static uint8_t *read_ppm(const char *fname, size_t *width, size_t *height) {
+    uint8_t *pixels = NULL;
+    size_t maxval;
+    FILE *fin = fopen(fname, "rb");
+    if (!fin)
+        return NULL;
+    if (fgetc(fin) != 'P' || fgetc(fin) != '6' || read_token(fin, width) || read_token(fin, height)
+            || read_token(fin, &maxval) || maxval != 255 || !*width || !*height)
+        goto end;
+    pixels = malloc(*width * *height * 3);
+    if (pixels && fread(pixels, *width * *height * 3, 1, fin) != 1) {
+        free(pixels);
+        pixels = NULL;
+    }
+
+end:
+    fclose(fin);
+    return pixels;
+}
+
+static HYDStatusCode train(const uint8_t *pixels, size_t width, size_t height, size_t d) {
+    HYDStatusCode ret = HYD_NOMEM;
+    const size_t out_len = 1 << 20;
+    uint8_t *out = malloc(out_len);
+    HYDEncoder *encoder = hyd_encoder_new(NULL);
+    if (!out || !encoder)
+        goto end;
+
+    HYDImageMetadata metadata = { 0 };
+    metadata.width = width;
+    metadata.height = height;
+    metadata.tile_size_shift_x = -1;
+    metadata.tile_size_shift_y = -1;
+    metadata.distance = distances[d];
+    encoder->hf_token_counts = counts[d];
+    ret = hyd_set_metadata(encoder, &metadata);
+    if (ret < HYD_ERROR_START)
+        goto end;
+    ret = hyd_provide_output_buffer(encoder, out, out_len);
+    if (ret < HYD_ERROR_START)
+        goto end;
+
+    for (uint32_t y = 0; y < (height + 2047) >> 11; y++) {
+        for (uint32_t x = 0; x < (width + 2047) >> 11; x++) {
+            const uint8_t *tile = pixels + ((y * width) << 11) * 3 + (x << 11) * 3;
+            const void *const rgb[3] = {tile, tile + 1, tile + 2};
+            ret = hyd_send_tile(encoder, rgb, x, y, width * 3, 3, -1, HYD_UINT8);
+            /* the output is not needed, only the counts */
+            while (ret == HYD_NEED_MORE_OUTPUT) {
+                size_t written;
+                hyd_release_output_buffer(encoder, &written);
+                hyd_provide_output_buffer(encoder, out, out_len);
+                ret = hyd_flush(encoder);
+            }
+            if (ret < HYD_ERROR_START)
+                goto end;
+        }
+    }
+
+end:
+    if (ret < HYD_ERROR_START && encoder)
+        fprintf(stderr, "Hydrium error occurred: %s\n", hyd_error_message_get(encoder));
+    hyd_encoder_destroy(encoder);
+    free(out);
+    return ret;
+}
+
+/* every token keeps a frequency of at least one, as any of them may turn up */
+static void normalize(uint16_t frequencies[64], const uint64_t cluster_counts[64]) {
+    uint64_t total = 0;
+    size_t top = 0;
+    for (size_t k = 0; k < 64; k++) {
+        total += cluster_counts[k];
+        if (cluster_counts[k] > cluster_counts[top])
+            top = k;
+    }
+    uint32_t sum = 0;
+    for (size_t k = 0; k < 64; k++) {
+        frequencies[k] = 1 + (total ? cluster_counts[k] * ((1 << 12) - 64) / total : 0);
+        sum += frequencies[k];
+    }
+    frequencies[top] += (1 << 12) - sum;
+}
+
+int main(int argc, const char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <input.ppm>... > src/libhydrium/hf-histograms.c\n", argv[0]);
+        return 1;
+    }
+
+    for (int i = 1; i < argc; i++) {
+        size_t width, height;
+        uint8_t *pixels = read_ppm(argv[i], &width, &height);
+        if (!pixels) {
+            fprintf(stderr, "%s: error reading PPM file: %s\n", argv[0], argv[i]);
+            return 2;
+        }
+        for (size_t d = 0; d < sizeof(distances) / sizeof(*distances); d++) {
+            if (train(pixels, width, height, d) < HYD_ERROR_START) {
+                free(pixels);
+                return 3;
+            }
+        }
+        free(pixels);
+    }
+
+    printf("/*\n");
+    printf(" * Fixed HF histograms, one row of token frequencies per cluster,\n");
+    printf(" * for each of the distances they were trained at\n");
+    printf(" * Generated by src/tools/hf-histograms.c, do not edit\n");
+    printf(" */\n");
+    printf("#include <stdint.h>\n\n");
+    printf("const float hf_fixed_distances[4] = {");
+    for (size_t d = 0; d < 4; d++)
+        printf("%s%.1ff", d ? ", " : "", distances[d]);
+    printf("};\n\n");
+    printf("const uint16_t hf_fixed_frequencies[4][45][64] = {\n");
+    for (size_t d = 0; d < 4; d++) {
+        printf("    {\n");
+        for (size_t c = 0; c < 45; c++) {
+            uint16_t frequencies[64];
+            normalize(frequencies, counts[d][c]);
+            printf("        {\n");
+            for (size_t k = 0; k < 64; k++)
+                printf("%s%4u,%s", k % 16 ? " " : "            ", frequencies[k], k % 16 == 15 ? "\n" : "");
+            printf("        },\n");
+        }
+        printf("    },\n");
+    }
+    printf("};\n");
+
+    return 0;
+}